@@ -1,9 +1,32 @@
 #include "Library.h"
 
 #include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 #include <iostream>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using std::cout;
 using std::endl;
 using std::string;
@@ -11,10 +34,271 @@ using std::vector;
 
 
 namespace {
+    // Hash kiểu cũ, chỉ còn dùng để kiểm tra tài khoản chưa được băm lại.
     string simpleHash(const string& input) {
         std::hash<string> hasher;
         return std::to_string(hasher(input));
     }
+
+    class Sha256 {
+    private:
+        uint32_t state[8];
+        unsigned char block[64];
+        size_t used{ 0 };
+        uint64_t totalBytes{ 0 };
+
+        static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void compress(const unsigned char* data) {
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+            };
+            uint32_t w[64];
+            for (int i = 0; i < 16; ++i) {
+                w[i] = (uint32_t(data[4 * i]) << 24) | (uint32_t(data[4 * i + 1]) << 16) |
+                       (uint32_t(data[4 * i + 2]) << 8) | uint32_t(data[4 * i + 3]);
+            }
+            for (int i = 16; i < 64; ++i) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; ++i) {
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+    public:
+        static const size_t kDigestSize = 32;
+
+        Sha256() {
+            static const uint32_t init[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+            };
+            std::memcpy(state, init, sizeof(state));
+        }
+
+        void update(const unsigned char* data, size_t size) {
+            totalBytes += size;
+            while (size > 0) {
+                size_t take = std::min(size, sizeof(block) - used);
+                std::memcpy(block + used, data, take);
+                used += take;
+                data += take;
+                size -= take;
+                if (used == sizeof(block)) {
+                    compress(block);
+                    used = 0;
+                }
+            }
+        }
+
+        void finish(unsigned char* digest) {
+            uint64_t bits = totalBytes * 8;
+            unsigned char pad = 0x80;
+            update(&pad, 1);
+            pad = 0;
+            while (used != 56) update(&pad, 1);
+            unsigned char length[8];
+            for (int i = 0; i < 8; ++i) length[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+            update(length, 8);
+            for (int i = 0; i < 8; ++i) {
+                digest[4 * i] = static_cast<unsigned char>(state[i] >> 24);
+                digest[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+                digest[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+                digest[4 * i + 3] = static_cast<unsigned char>(state[i]);
+            }
+        }
+    };
+
+    // PBKDF2-HMAC-SHA256 cho đúng một khối 32 byte. Trạng thái sau khối ipad/opad được
+    // tính một lần, mỗi vòng chỉ còn băm 32 byte cho mỗi phía.
+    void pbkdf2Sha256(const string& password, const string& salt, int iterations, unsigned char* out) {
+        unsigned char key[64] = {};
+        if (password.size() > sizeof(key)) {
+            Sha256 keyHash;
+            keyHash.update(reinterpret_cast<const unsigned char*>(password.data()), password.size());
+            keyHash.finish(key);
+        } else {
+            std::memcpy(key, password.data(), password.size());
+        }
+        unsigned char ipad[64], opad[64];
+        for (int i = 0; i < 64; ++i) {
+            ipad[i] = key[i] ^ 0x36;
+            opad[i] = key[i] ^ 0x5c;
+        }
+        Sha256 inner, outer;
+        inner.update(ipad, sizeof(ipad));
+        outer.update(opad, sizeof(opad));
+
+        auto hmac = [&](const unsigned char* message, size_t size, unsigned char* digest) {
+            Sha256 h = inner;
+            h.update(message, size);
+            h.finish(digest);
+            h = outer;
+            h.update(digest, Sha256::kDigestSize);
+            h.finish(digest);
+        };
+
+        string first = salt + string("\0\0\0\1", 4);
+        unsigned char u[Sha256::kDigestSize];
+        hmac(reinterpret_cast<const unsigned char*>(first.data()), first.size(), u);
+        std::memcpy(out, u, sizeof(u));
+        for (int round = 1; round < iterations; ++round) {
+            hmac(u, sizeof(u), u);
+            for (size_t i = 0; i < sizeof(u); ++i) out[i] ^= u[i];
+        }
+    }
+
+    string toHex(const unsigned char* data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        string hex(size * 2, '0');
+        for (size_t i = 0; i < size; ++i) {
+            hex[2 * i] = digits[data[i] >> 4];
+            hex[2 * i + 1] = digits[data[i] & 0xf];
+        }
+        return hex;
+    }
+
+    bool fromHex(std::string_view hex, string& out) {
+        if (hex.size() % 2 != 0) return false;
+        auto value = [](char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            return -1;
+        };
+        out.resize(hex.size() / 2);
+        for (size_t i = 0; i < out.size(); ++i) {
+            int high = value(hex[2 * i]);
+            int low = value(hex[2 * i + 1]);
+            if (high < 0 || low < 0) return false;
+            out[i] = static_cast<char>((high << 4) | low);
+        }
+        return true;
+    }
+
+    const string kPasswordScheme = "pbkdf2-sha256";
+    const size_t kSaltBytes = 16;
+    std::atomic<int> passwordIterations{ PasswordHasher::kDefaultIterations };
+
+    struct ParsedPasswordHash {
+        int iterations{};
+        string salt;
+        string digest;
+    };
+
+    bool parsePasswordHash(const string& stored, ParsedPasswordHash& parsed) {
+        std::string_view text(stored);
+        if (text.substr(0, kPasswordScheme.size() + 1) != kPasswordScheme + "$") return false;
+        text.remove_prefix(kPasswordScheme.size() + 1);
+        size_t first = text.find('$');
+        size_t second = first == std::string_view::npos ? first : text.find('$', first + 1);
+        if (second == std::string_view::npos) return false;
+        auto result = std::from_chars(text.data(), text.data() + first, parsed.iterations);
+        if (result.ec != std::errc() || result.ptr != text.data() + first || parsed.iterations <= 0) return false;
+        return fromHex(text.substr(first + 1, second - first - 1), parsed.salt) &&
+               fromHex(text.substr(second + 1), parsed.digest) &&
+               parsed.digest.size() == Sha256::kDigestSize;
+    }
+
+    // Mã thao tác trong journal; chỉ được thêm mới, không đổi số của mã cũ.
+    enum JournalOp : int64_t {
+        OpAddBook = 1,
+        OpEditBook = 2,
+        OpRemoveBook = 3,
+        OpRegisterMember = 4,
+        OpRemoveMember = 5,
+        OpChangePassword = 6,
+        OpBorrow = 7,
+        OpReturn = 8,
+        OpRenew = 9
+    };
+
+    const size_t kCheckpointInterval = 10000;
+    const size_t kCatalogLoadBatch = 4096;
+    const size_t kLoginPoolThreads = 2;
+
+    // Luồng đang phát lại journal thì không ghi journal. Để theo luồng (không theo đối
+    // tượng) vì luồng nạp nền phát lại trong khi luồng chính vẫn ghi bình thường.
+    thread_local bool replayingJournal = false;
+    // Khác 0 khi luồng hiện tại đã giữ khoá catalog (luồng nạp nền luôn giữ); lời gọi
+    // lồng nhau như findBookById trong searchBooksPage không khoá lại lần nữa.
+    thread_local int catalogLockDepth = 0;
+
+    class CatalogReadLock {
+    private:
+        std::shared_mutex* mutex{ nullptr };
+    public:
+        CatalogReadLock(std::shared_mutex& m, bool loading) {
+            if (!loading || catalogLockDepth > 0) return;
+            mutex = &m;
+            mutex->lock_shared();
+            catalogLockDepth = 1;
+        }
+        ~CatalogReadLock() {
+            if (!mutex) return;
+            catalogLockDepth = 0;
+            mutex->unlock_shared();
+        }
+        CatalogReadLock(const CatalogReadLock&) = delete;
+        CatalogReadLock& operator=(const CatalogReadLock&) = delete;
+    };
+}
+
+
+void PasswordHasher::setIterations(int iterations) {
+    passwordIterations.store(std::max(iterations, 1), std::memory_order_relaxed);
+}
+
+int PasswordHasher::iterations() {
+    return passwordIterations.load(std::memory_order_relaxed);
+}
+
+string PasswordHasher::hash(const string& password) {
+    static thread_local std::mt19937_64 generator{ std::random_device{}() };
+    unsigned char salt[kSaltBytes];
+    for (size_t i = 0; i < kSaltBytes; i += 8) {
+        uint64_t bits = generator();
+        std::memcpy(salt + i, &bits, 8);
+    }
+    int rounds = iterations();
+    unsigned char digest[Sha256::kDigestSize];
+    pbkdf2Sha256(password, string(reinterpret_cast<const char*>(salt), kSaltBytes), rounds, digest);
+    return kPasswordScheme + "$" + std::to_string(rounds) + "$" + toHex(salt, kSaltBytes) + "$" +
+           toHex(digest, sizeof(digest));
+}
+
+// So sánh không dừng sớm để thời gian không lộ số byte khớp.
+bool PasswordHasher::verify(const string& password, const string& stored) {
+    ParsedPasswordHash parsed;
+    if (!parsePasswordHash(stored, parsed)) {
+        return !stored.empty() && stored == simpleHash(password);
+    }
+    unsigned char digest[Sha256::kDigestSize];
+    pbkdf2Sha256(password, parsed.salt, parsed.iterations, digest);
+    unsigned char diff = 0;
+    for (size_t i = 0; i < sizeof(digest); ++i) {
+        diff |= static_cast<unsigned char>(digest[i] ^ static_cast<unsigned char>(parsed.digest[i]));
+    }
+    return diff == 0;
+}
+
+bool PasswordHasher::needsRehash(const string& stored) {
+    ParsedPasswordHash parsed;
+    return !parsePasswordHash(stored, parsed) || parsed.iterations < iterations();
 }
 
 
@@ -28,7 +312,8 @@ MemberAccount::MemberAccount(
     const string& email,
     const string& rawPassword,
     NotificationPreference pref,
-    const LibraryCard& card
+    const LibraryCard& card,
+    AccountRole role
 )
     : id(id),
       fullName(fullName),
@@ -37,17 +322,18 @@ MemberAccount::MemberAccount(
       address(address),
       phone(phone),
       email(email),
-      passwordHash(simpleHash(rawPassword)),
+      passwordHash(rawPassword.empty() ? string() : PasswordHasher::hash(rawPassword)),
       preference(pref),
-      card(card) {
+      card(card),
+      role(role) {
 }
 
 bool MemberAccount::checkPassword(const string& rawPassword) const {
-    return passwordHash == simpleHash(rawPassword);
+    return PasswordHasher::verify(rawPassword, passwordHash);
 }
 
 void MemberAccount::changePassword(const string& newRawPassword) {
-    passwordHash = simpleHash(newRawPassword);
+    passwordHash = PasswordHasher::hash(newRawPassword);
 }
 
 void MemberAccount::updateProfile(const string& newName, const string& newAddress, const string& newPhone) {
@@ -58,25 +344,25 @@ void MemberAccount::updateProfile(const string& newName, const string& newAddres
 
 
 Book::Book(int id,
-           const string& isbn,
-           const string& title,
-           const string& author,
-           const string& subject,
+           string isbn,
+           string title,
+           string author,
+           string subject,
            int publicationYear,
-           const string& language,
+           string language,
            int pages,
-           const string& rackPosition,
-           const string& description)
+           string rackPosition,
+           string description)
     : id(id),
-      isbn(isbn),
-      title(title),
-      author(author),
-      subject(subject),
+      isbn(std::move(isbn)),
+      title(std::move(title)),
+      author(std::move(author)),
+      subject(std::move(subject)),
       publicationYear(publicationYear),
-      language(language),
+      language(std::move(language)),
       pages(pages),
-      rackPosition(rackPosition),
-      description(description) {
+      rackPosition(std::move(rackPosition)),
+      description(std::move(description)) {
 }
 
 void Book::updateInfo(const string& newTitle,
@@ -98,12 +384,12 @@ void Book::updateInfo(const string& newTitle,
 }
 
 
-BookItem::BookItem(int id, int bookId, const string& barcode, bool available, const string& location)
+BookItem::BookItem(int id, int bookId, string barcode, bool available, string location)
     : id(id),
       bookId(bookId),
-      barcode(barcode),
+      barcode(std::move(barcode)),
       available(available),
-      location(location) {
+      location(std::move(location)) {
 }
 
 
@@ -123,6 +409,26 @@ Loan::Loan(int id,
       fine(0.0) {
 }
 
+Loan::Loan(int id,
+           int memberId,
+           const vector<int>& bookItemIds,
+           int borrowDate,
+           int dueDate,
+           int returnDate,
+           int renewalCount,
+           LoanStatus status,
+           double fine)
+    : id(id),
+      memberId(memberId),
+      bookItemIds(bookItemIds),
+      borrowDate(borrowDate),
+      dueDate(dueDate),
+      returnDate(returnDate),
+      renewalCount(renewalCount),
+      status(status),
+      fine(fine) {
+}
+
 void Loan::markReturned(int actualReturnDate, double finePerDay) {
     returnDate = actualReturnDate;
     if (actualReturnDate > dueDate) {
@@ -135,19 +441,23 @@ void Loan::markReturned(int actualReturnDate, double finePerDay) {
     }
 }
 
+// Phiếu đã bị lượt quét đánh dấu quá hạn nhưng chưa trả vẫn được gia hạn như trước.
 bool Loan::canRenew(int maxRenewals) const {
-    return status == LoanStatus::Active && renewalCount < maxRenewals;
+    return isOut() && renewalCount < maxRenewals;
 }
 
+// Gia hạn đưa phiếu về Active; nếu hạn mới vẫn đã qua, lượt quét kế tiếp tính lại tiền phạt.
 void Loan::renew(int extraDays) {
-    if (status == LoanStatus::Active) {
+    if (isOut()) {
         dueDate += extraDays;
         ++renewalCount;
+        status = LoanStatus::Active;
+        fine = 0.0;
     }
 }
 
 void Loan::markOverdue(double finePerDay, int today) {
-    if (status == LoanStatus::Active && today > dueDate) {
+    if (isOut() && today > dueDate) {
         int overdueDays = today - dueDate;
         fine = overdueDays * finePerDay;
         status = LoanStatus::Overdue;
@@ -163,295 +473,3780 @@ Reservation::Reservation(int id, int memberId, int bookId)
 }
 
 
-LibrarySystem::LibrarySystem() {
+CopyGroup::CopyGroup(int firstCopyId, int total)
+    : firstCopyId(firstCopyId),
+      total(total),
+      available(total),
+      availableBits((static_cast<size_t>(total) + 63) / 64, ~uint64_t{ 0 }) {
+    if (total % 64 != 0) {
+        availableBits.back() = (uint64_t{ 1 } << (total % 64)) - 1;
+    }
+}
 
+void CopyGroup::setAvailable(int copyId, bool value) {
+    if (!contains(copyId)) return;
+    size_t bit = static_cast<size_t>(copyId - firstCopyId);
+    uint64_t mask = uint64_t{ 1 } << (bit % 64);
+    uint64_t& word = availableBits[bit / 64];
+    if (((word & mask) != 0) == value) return;
+    if (value) {
+        word |= mask;
+        ++available;
+    } else {
+        word &= ~mask;
+        --available;
+    }
 }
 
-MemberAccount* LibrarySystem::registerMember(
-    const string& fullName,
-    const string& dob,
-    Gender gender,
-    const string& address,
-    const string& phone,
-    const string& email,
-    const string& password,
-    NotificationPreference pref) {
+int CopyGroup::firstAvailableCopyId() const {
+    if (available == 0) return -1;
+    for (size_t i = 0; i < availableBits.size(); ++i) {
+        if (availableBits[i] != 0) {
+            return firstCopyId + static_cast<int>(i * 64) + __builtin_ctzll(availableBits[i]);
+        }
+    }
+    return -1;
+}
 
-    if (findMemberByEmail(email) != nullptr) {
-        cout << "Email da ton tai trong he thong.\n";
-        return nullptr;
+
+namespace {
+    size_t findScalar(const char* haystack, size_t length, std::string_view needle) {
+        return std::string_view(haystack, length).find(needle);
     }
 
-    if (password.size() < 6) {
-        cout << "Mat khau phai co it nhat 6 ky tu.\n";
-        return nullptr;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // So khớp ký tự đầu và cuối của needle trên cả khối 16/32 byte, chỉ memcmp
+    // phần giữa tại các vị trí ứng viên.
+    __attribute__((target("sse2")))
+    size_t findSse2(const char* haystack, size_t length, std::string_view needle) {
+        const size_t m = needle.size();
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 16 <= length; i += 16) {
+            __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+            __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + m - 1));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+            while (mask) {
+                unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+                if (m <= 2 || std::memcmp(haystack + i + bit + 1, needle.data() + 1, m - 2) == 0) return i + bit;
+                mask &= mask - 1;
+            }
+        }
+        size_t rest = findScalar(haystack + i, length - i, needle);
+        return rest == string::npos ? string::npos : i + rest;
     }
 
-    LibraryCard card;
-    card.cardNumber = "CARD-" + std::to_string(nextMemberId);
-    card.issuedDate = "Today";
-    card.active = true;
+    __attribute__((target("avx2")))
+    size_t findAvx2(const char* haystack, size_t length, std::string_view needle) {
+        const size_t m = needle.size();
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 32 <= length; i += 32) {
+            __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i));
+            __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + m - 1));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast))));
+            while (mask) {
+                unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+                if (m <= 2 || std::memcmp(haystack + i + bit + 1, needle.data() + 1, m - 2) == 0) return i + bit;
+                mask &= mask - 1;
+            }
+        }
+        size_t rest = findSse2(haystack + i, length - i, needle);
+        return rest == string::npos ? string::npos : i + rest;
+    }
+#endif
+
+    using FindFn = size_t (*)(const char*, size_t, std::string_view);
 
-    members.emplace_back(nextMemberId++,
-        fullName, dob, gender, address, phone, email, password, pref, card);
+    FindFn selectFind() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return findAvx2;
+        if (__builtin_cpu_supports("sse2")) return findSse2;
+#endif
+        return findScalar;
+    }
+}
 
-    cout << "Dang ky thanh cong. So the thu vien: " << card.cardNumber << "\n";
-    return &members.back();
+size_t TextArena::find(const char* haystack, size_t length, std::string_view needle) {
+    static const FindFn kernel = selectFind();
+    if (needle.empty()) return 0;
+    if (length < needle.size()) return string::npos;
+    return kernel(haystack, length, needle);
 }
 
-MemberAccount* LibrarySystem::findMemberByEmail(const string& email) {
-    for (auto& m : members) {
-        if (m.getEmail() == email) return &m;
+void TextArena::set(int bookId, std::string_view foldedText) {
+    if (bookId <= 0) return;
+    erase(bookId);
+    if (static_cast<size_t>(bookId) >= recordOfBook.size()) {
+        recordOfBook.resize(static_cast<size_t>(bookId) + 1, -1);
     }
-    return nullptr;
+    if (bookId < maxBookId) idOrdered = false;
+    maxBookId = std::max(maxBookId, bookId);
+    recordOfBook[bookId] = static_cast<int>(records.size());
+    records.push_back({ bytes.size(), foldedText.size(), bookId });
+    bytes.append(foldedText.data(), foldedText.size());
+    bytes.push_back('\0');
+    ++liveRecords;
 }
 
-const MemberAccount* LibrarySystem::findMemberByEmail(const string& email) const {
-    for (const auto& m : members) {
-        if (m.getEmail() == email) return &m;
+void TextArena::erase(int bookId) {
+    if (bookId <= 0 || static_cast<size_t>(bookId) >= recordOfBook.size()) return;
+    int index = recordOfBook[bookId];
+    if (index < 0) return;
+    records[index].bookId = 0;
+    recordOfBook[bookId] = -1;
+    deadBytes += records[index].length + 1;
+    --liveRecords;
+    if (deadBytes > bytes.size() / 2) compact();
+}
+
+// Dựng lại vùng nhớ theo thứ tự id sách, bỏ các bản ghi đã chết.
+void TextArena::compact() {
+    string packed;
+    packed.reserve(bytes.size() - deadBytes);
+    vector<Record> packedRecords;
+    packedRecords.reserve(liveRecords);
+    for (size_t bookId = 1; bookId < recordOfBook.size(); ++bookId) {
+        int index = recordOfBook[bookId];
+        if (index < 0) continue;
+        const Record& old = records[index];
+        recordOfBook[bookId] = static_cast<int>(packedRecords.size());
+        packedRecords.push_back({ packed.size(), old.length, old.bookId });
+        packed.append(bytes, old.offset, old.length);
+        packed.push_back('\0');
     }
-    return nullptr;
+    bytes.swap(packed);
+    records.swap(packedRecords);
+    deadBytes = 0;
+    maxBookId = records.empty() ? 0 : records.back().bookId;
+    idOrdered = true;
 }
 
-MemberAccount* LibrarySystem::login(const string& email, const string& password) {
-    MemberAccount* m = findMemberByEmail(email);
-    if (!m) {
+std::string_view TextArena::text(int bookId) const {
+    if (bookId <= 0 || static_cast<size_t>(bookId) >= recordOfBook.size()) return {};
+    int index = recordOfBook[bookId];
+    if (index < 0) return {};
+    return std::string_view(bytes.data() + records[index].offset, records[index].length);
+}
 
-        return nullptr;
+bool TextArena::contains(int bookId, std::string_view needle) const {
+    std::string_view record = text(bookId);
+    if (record.data() == nullptr) return false;
+    return find(record.data(), record.size(), needle) != string::npos;
+}
+
+// Quét cả vùng nhớ một lượt; trúng ở bản ghi nào thì ghi id và nhảy sang bản ghi kế.
+// Needle không chứa '\0' nên không thể khớp vắt qua hai bản ghi.
+void TextArena::scan(std::string_view needle, vector<int>& bookIds) const {
+    if (needle.find('\0') != std::string_view::npos) {
+        for (const auto& r : records) {
+            if (r.bookId > 0 && std::string_view(bytes.data() + r.offset, r.length).find(needle) != std::string_view::npos) {
+                bookIds.push_back(r.bookId);
+            }
+        }
+    } else {
+        size_t position = 0;
+        auto record = records.begin();
+        while (position < bytes.size()) {
+            size_t hit = find(bytes.data() + position, bytes.size() - position, needle);
+            if (hit == string::npos) break;
+            hit += position;
+            record = std::upper_bound(record, records.end(), hit,
+                [](size_t offset, const Record& r) { return offset < r.offset; }) - 1;
+            if (record->bookId > 0) bookIds.push_back(record->bookId);
+            position = record->offset + record->length + 1;
+            ++record;
+        }
     }
-    if (!m->checkPassword(password)) {
-        // cout << "Sai mat khau.\n";
-        return nullptr;
+    if (!idOrdered) std::sort(bookIds.begin(), bookIds.end());
+}
+
+
+string TrigramIndex::fold(const string& text) {
+    string folded;
+    foldInto(text, folded);
+    return folded;
+}
+
+void TrigramIndex::foldInto(const string& text, string& out) {
+    out.assign(text);
+    for (char& c : out) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
     }
-    // Giao diện main sẽ in thông báo chào mừng
-    return m;
 }
 
-void LibrarySystem::forgotPassword(const string& email, const string& newPassword) {
-    MemberAccount* m = findMemberByEmail(email);
-    if (!m) {
-        cout << "This email is not registered in the system.\n";
-        return;
+string TrigramIndex::bookText(const Book& book) {
+    return fold(book.getTitle() + " " + book.getDescription());
+}
+
+vector<uint32_t> TrigramIndex::gramsOf(std::string_view text) {
+    vector<uint32_t> grams;
+    if (text.size() < kGramSize) return grams;
+    grams.reserve(text.size() - kGramSize + 1);
+    for (size_t i = 0; i + kGramSize <= text.size(); ++i) {
+        grams.push_back((static_cast<uint32_t>(static_cast<unsigned char>(text[i])) << 16) |
+                        (static_cast<uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8) |
+                        static_cast<uint32_t>(static_cast<unsigned char>(text[i + 2])));
     }
-    cout << "Gui ma xac thuc / lien ket reset password toi " << email << "...\n";
-    m->changePassword(newPassword);
-    cout << "Mat khau da duoc cap nhat.\n";
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
 }
 
-Book* LibrarySystem::addBook(const string& isbn,
-                             const string& title,
-                             const string& author,
-                             const string& subject,
-                             int publicationYear,
-                             const string& language,
-                             int pages,
-                             const string& rackPosition,
-                             const string& description,
-                             int numCopies) {
-    int bookId = nextBookId++;
-    books.emplace_back(bookId, isbn, title, author, subject,
-                       publicationYear, language, pages, rackPosition, description);
+void TrigramIndex::add(int bookId, const string& foldedText) {
+    if (bookId <= 0) return;
+    texts.set(bookId, foldedText);
+    for (uint32_t gram : gramsOf(foldedText)) {
+        vector<int>& list = postings[gram];
+        // Sách mới luôn có id lớn nhất nên thường chỉ cần push_back.
+        if (list.empty() || list.back() < bookId) {
+            list.push_back(bookId);
+        } else {
+            auto it = std::lower_bound(list.begin(), list.end(), bookId);
+            if (it == list.end() || *it != bookId) list.insert(it, bookId);
+        }
+    }
+}
 
-    for (int i = 0; i < numCopies; ++i) {
-        string barcode = "BC-" + std::to_string(bookId) + "-" + std::to_string(i + 1);
-        copies.emplace_back(nextCopyId++, bookId, barcode, true, rackPosition);
+void TrigramIndex::remove(int bookId) {
+    for (uint32_t gram : gramsOf(texts.text(bookId))) {
+        auto found = postings.find(gram);
+        if (found == postings.end()) continue;
+        vector<int>& list = found->second;
+        auto it = std::lower_bound(list.begin(), list.end(), bookId);
+        if (it != list.end() && *it == bookId) list.erase(it);
+        if (list.empty()) postings.erase(found);
     }
+    texts.erase(bookId);
+}
 
-    return &books.back();
+bool TrigramIndex::textContains(int bookId, const string& foldedKeyword) const {
+    return texts.contains(bookId, foldedKeyword);
 }
 
-bool LibrarySystem::editBook(int bookId,
-                             const string& title,
-                             const string& author,
-                             const string& subject,
-                             int publicationYear,
-                             const string& language,
-                             int pages,
-                             const string& rackPosition,
-                             const string& description) {
-    Book* b = findBookById(bookId);
-    if (!b) return false;
-    b->updateInfo(title, author, subject, publicationYear, language, pages, rackPosition, description);
-    for (auto& c : copies) {
-        if (c.getBookId() == bookId) {
-            
-            c = BookItem(c.getId(), c.getBookId(), c.getBarcode(), c.isAvailable(), rackPosition);
+void TrigramIndex::scan(const string& foldedKeyword, vector<int>& bookIds) const {
+    texts.scan(foldedKeyword, bookIds);
+}
+
+// Trả về false khi trigram hiếm nhất vẫn quá phổ biến: khi đó quét tuần tự cả
+// arena nhanh hơn tra nhị phân từng ứng viên, người gọi nên chuyển sang quét.
+bool TrigramIndex::search(const string& foldedKeyword, vector<int>& bookIds) const {
+    vector<const vector<int>*> lists;
+    for (uint32_t gram : gramsOf(foldedKeyword)) {
+        auto found = postings.find(gram);
+        if (found == postings.end()) return true;
+        lists.push_back(&found->second);
+    }
+    if (lists.empty()) return true;
+
+    std::sort(lists.begin(), lists.end(),
+        [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+    if (lists[0]->size() * 8 > texts.size()) return false;
+    // Duyệt danh sách ngắn nhất, tra các danh sách còn lại bằng tìm kiếm nhị phân.
+    for (int bookId : *lists[0]) {
+        bool inAll = true;
+        for (size_t i = 1; i < lists.size() && inAll; ++i) {
+            inAll = std::binary_search(lists[i]->begin(), lists[i]->end(), bookId);
+        }
+        if (inAll && textContains(bookId, foldedKeyword)) {
+            bookIds.push_back(bookId);
         }
     }
     return true;
 }
 
-bool LibrarySystem::removeBook(int bookId) {
- 
-    for (const auto& loan : loans) {
-        for (int copyId : loan.getBookItemIds()) {
-            const BookItem* copy = findCopyById(copyId);
-            if (copy && copy->getBookId() == bookId && loan.getStatus() == LoanStatus::Active) {
-                cout << "Khong the xoa sach dang duoc muon.\n";
-                return false;
-            }
-        }
-    }
 
-    books.erase(std::remove_if(books.begin(), books.end(),
-        [bookId](const Book& b) { return b.getId() == bookId; }),
-        books.end());
 
-    copies.erase(std::remove_if(copies.begin(), copies.end(),
-        [bookId](const BookItem& c) { return c.getBookId() == bookId; }),
-        copies.end());
+string QueryCache::makeKey(const string& foldedKeyword,
+                           const string& author,
+                           const string& subject,
+                           int year,
+                           SearchMode mode) {
+    string key = foldedKeyword;
+    key += '\x1f';
+    key += author;
+    key += '\x1f';
+    key += subject;
+    key += '\x1f';
+    key += std::to_string(year);
+    key += mode == SearchMode::FullScan ? "\x1f" "F" : "\x1f" "A";
+    return key;
+}
 
+bool QueryCache::find(const string& key, uint64_t generation, vector<int>& bookIds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second->generation != generation) {
+        ++misses;
+        return false;
+    }
+    recent.splice(recent.begin(), recent, it->second);
+    bookIds = it->second->bookIds;
+    ++hits;
     return true;
 }
 
-vector<int> LibrarySystem::searchBooks(const string& keyword,
-                                       const string& author,
-                                       const string& subject,
-                                       int year) const {
-    vector<int> resultIds;
-    for (const auto& b : books) {
-        bool match = true;
-        if (!keyword.empty()) {
-            string lowerKey = keyword;
-            std::transform(lowerKey.begin(), lowerKey.end(), lowerKey.begin(), ::tolower);
-            string combined = b.getTitle() + " " + b.getDescription();
-            std::transform(combined.begin(), combined.end(), combined.begin(), ::tolower);
-            if (combined.find(lowerKey) == string::npos) match = false;
-        }
-        if (match && !author.empty() && b.getAuthor().find(author) == string::npos) {
-            match = false;
-        }
-        if (match && !subject.empty() && b.getSubject().find(subject) == string::npos) {
-            match = false;
-        }
-        if (match && year != 0 && b.getPublicationYear() != year) {
-            match = false;
-        }
-        if (match) {
-            resultIds.push_back(b.getId());
-        }
+void QueryCache::store(const string& key, uint64_t generation, const vector<int>& bookIds) {
+    if (capacity == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        it->second->generation = generation;
+        it->second->bookIds = bookIds;
+        recent.splice(recent.begin(), recent, it->second);
+        return;
     }
-    return resultIds;
+    if (entries.size() >= capacity) {
+        entries.erase(recent.back().key);
+        recent.pop_back();
+    }
+    recent.push_front(Entry{ key, generation, bookIds });
+    entries.emplace(key, recent.begin());
 }
 
-int LibrarySystem::countAvailableCopies(int bookId) const {
-    int count = 0;
-    for (const auto& c : copies) {
-        if (c.getBookId() == bookId && c.isAvailable()) {
-            ++count;
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    recent.clear();
+    entries.clear();
+}
+
+QueryCacheStats QueryCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return QueryCacheStats{ hits, misses, entries.size(), capacity };
+}
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) threadCount = 1;
+    for (size_t i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        queued.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::runOne(size_t preferredQueue) {
+    std::function<void()> task;
+    for (size_t k = 0; k < queues.size() && !task; ++k) {
+        size_t index = (preferredQueue + k) % queues.size();
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        auto& tasks = queues[index]->tasks;
+        if (tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
         }
     }
-    return count;
+    if (!task) return false;
+    queued.fetch_sub(1, std::memory_order_acq_rel);
+    task();
+    return true;
 }
 
-Loan* LibrarySystem::borrowBooks(int memberId, const vector<int>& bookItemIds, int today) {
+void ThreadPool::workerLoop(size_t index) {
+    while (true) {
+        if (runOne(index)) continue;
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping && queued.load(std::memory_order_acquire) == 0) return;
+    }
+}
 
-    int currentBorrowed = 0;
-    for (const auto& loan : loans) {
-        if (loan.getMemberId() == memberId && loan.getStatus() == LoanStatus::Active) {
-            currentBorrowed += static_cast<int>(loan.getBookItemIds().size());
+// remaining chỉ được đọc/ghi khi giữ doneMutex: luồng cuối cùng giảm và báo trong khi
+// còn giữ khoá, nên người gọi không thể thấy 0 rồi huỷ mutex/cv lúc luồng đó còn dùng.
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    size_t remaining = count;
+    std::mutex doneMutex;
+    std::condition_variable done;
+    for (size_t i = 0; i < count; ++i) {
+        submit([&, i] {
+            fn(i);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (--remaining == 0) done.notify_all();
+        });
+    }
+    size_t self = nextQueue.load(std::memory_order_relaxed);
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (remaining == 0) return;
         }
+        if (runOne(self)) continue;
+        // Hàng đợi đã cạn: các phần còn lại đang chạy trên luồng khác.
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return remaining == 0; });
+        return;
     }
-    if (currentBorrowed + static_cast<int>(bookItemIds.size()) > maxBorrowedBooks) {
-        cout << "Vuot qua gioi han muon sach (" << maxBorrowedBooks << ").\n";
-        return nullptr;
+}
+
+RoaringBitmap::Container* RoaringBitmap::findContainer(uint16_t key) {
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+        [](const Container& c, uint16_t k) { return c.key < k; });
+    return (it != containers.end() && it->key == key) ? &*it : nullptr;
+}
+
+const RoaringBitmap::Container* RoaringBitmap::findContainer(uint16_t key) const {
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+        [](const Container& c, uint16_t k) { return c.key < k; });
+    return (it != containers.end() && it->key == key) ? &*it : nullptr;
+}
+
+void RoaringBitmap::toBitset(Container& c) {
+    c.bits.assign(1024, 0);
+    for (uint16_t low : c.array) {
+        c.bits[low >> 6] |= uint64_t{ 1 } << (low & 63);
     }
+    vector<uint16_t>().swap(c.array);
+}
 
-    for (int copyId : bookItemIds) {
-        BookItem* copy = findCopyById(copyId);
-        if (!copy || !copy->isAvailable()) {
-            cout << "Ban sao sach co ID " << copyId << " khong san sang de muon.\n";
-            return nullptr;
+void RoaringBitmap::toArray(Container& c) {
+    vector<uint16_t> array;
+    array.reserve(static_cast<size_t>(c.cardinality));
+    for (size_t w = 0; w < c.bits.size(); ++w) {
+        uint64_t word = c.bits[w];
+        while (word) {
+            array.push_back(static_cast<uint16_t>(w * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
         }
     }
+    c.array.swap(array);
+    vector<uint64_t>().swap(c.bits);
+}
 
-    int loanId = nextLoanId++;
-    int due = today + 14;
-    loans.emplace_back(loanId, memberId, bookItemIds, today, due);
+void RoaringBitmap::add(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+        [](const Container& c, uint16_t k) { return c.key < k; });
+    if (it == containers.end() || it->key != key) {
+        it = containers.insert(it, Container());
+        it->key = key;
+    }
+    Container& c = *it;
+    if (c.isBitset()) {
+        uint64_t mask = uint64_t{ 1 } << (low & 63);
+        if ((c.bits[low >> 6] & mask) == 0) {
+            c.bits[low >> 6] |= mask;
+            ++c.cardinality;
+        }
+        return;
+    }
+    auto pos = std::lower_bound(c.array.begin(), c.array.end(), low);
+    if (pos != c.array.end() && *pos == low) return;
+    c.array.insert(pos, low);
+    if (++c.cardinality > kArrayLimit) toBitset(c);
+}
 
-    for (int copyId : bookItemIds) {
-        BookItem* copy = findCopyById(copyId);
-        if (copy) copy->setAvailable(false);
+void RoaringBitmap::remove(uint32_t value) {
+    Container* c = findContainer(static_cast<uint16_t>(value >> 16));
+    if (!c) return;
+    uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+    if (c->isBitset()) {
+        uint64_t mask = uint64_t{ 1 } << (low & 63);
+        if ((c->bits[low >> 6] & mask) == 0) return;
+        c->bits[low >> 6] &= ~mask;
+        if (--c->cardinality <= kArrayLimit) toArray(*c);
+    } else {
+        auto pos = std::lower_bound(c->array.begin(), c->array.end(), low);
+        if (pos == c->array.end() || *pos != low) return;
+        c->array.erase(pos);
+        --c->cardinality;
     }
+    if (c->cardinality == 0) {
+        containers.erase(containers.begin() + (c - containers.data()));
+    }
+}
 
-    cout << "Tao phieu muon #" << loanId << " thanh cong.\n";
-    return &loans.back();
+bool RoaringBitmap::contains(uint32_t value) const {
+    const Container* c = findContainer(static_cast<uint16_t>(value >> 16));
+    if (!c) return false;
+    uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+    if (c->isBitset()) return (c->bits[low >> 6] >> (low & 63)) & 1;
+    return std::binary_search(c->array.begin(), c->array.end(), low);
 }
 
-bool LibrarySystem::returnLoan(int loanId, int actualReturnDate) {
-    for (auto& loan : loans) {
-        if (loan.getId() == loanId && loan.getStatus() == LoanStatus::Active) {
-            loan.markReturned(actualReturnDate, finePerDay);
-            for (int copyId : loan.getBookItemIds()) {
-                BookItem* copy = findCopyById(copyId);
-                if (copy) copy->setAvailable(true);
+size_t RoaringBitmap::cardinality() const {
+    size_t total = 0;
+    for (const auto& c : containers) total += static_cast<size_t>(c.cardinality);
+    return total;
+}
+
+RoaringBitmap& RoaringBitmap::operator&=(const RoaringBitmap& other) {
+    vector<Container> result;
+    auto a = containers.begin();
+    auto b = other.containers.begin();
+    while (a != containers.end() && b != other.containers.end()) {
+        if (a->key < b->key) { ++a; continue; }
+        if (b->key < a->key) { ++b; continue; }
+        Container c;
+        c.key = a->key;
+        if (a->isBitset() && b->isBitset()) {
+            c.bits.resize(1024);
+            for (size_t w = 0; w < 1024; ++w) {
+                c.bits[w] = a->bits[w] & b->bits[w];
+                c.cardinality += __builtin_popcountll(c.bits[w]);
+            }
+            if (c.cardinality <= kArrayLimit) toArray(c);
+        } else if (a->isBitset() || b->isBitset()) {
+            const Container& bitset = a->isBitset() ? *a : *b;
+            const Container& array = a->isBitset() ? *b : *a;
+            for (uint16_t low : array.array) {
+                if ((bitset.bits[low >> 6] >> (low & 63)) & 1) c.array.push_back(low);
             }
-            cout << "Cap nhat tra sach cho phieu muon #" << loanId
-                 << ". Tien phat: " << loan.getFine() << "\n";
-            return true;
+            c.cardinality = static_cast<int>(c.array.size());
+        } else {
+            std::set_intersection(a->array.begin(), a->array.end(),
+                                  b->array.begin(), b->array.end(),
+                                  std::back_inserter(c.array));
+            c.cardinality = static_cast<int>(c.array.size());
         }
+        if (c.cardinality > 0) result.push_back(std::move(c));
+        ++a;
+        ++b;
     }
-    cout << "Khong tim thay phieu muon hop le.\n";
-    return false;
+    containers.swap(result);
+    return *this;
 }
 
-bool LibrarySystem::renewLoan(int loanId, int extraDays) {
-    for (auto& loan : loans) {
-        if (loan.getId() == loanId) {
-            if (!loan.canRenew(maxRenewals)) {
-                cout << "Khong the gia han phieu muon #" << loanId << " (vuot qua so lan cho phep hoac khong con hieu luc).\n";
-                return false;
+RoaringBitmap& RoaringBitmap::operator|=(const RoaringBitmap& other) {
+    vector<Container> result;
+    auto a = containers.begin();
+    auto b = other.containers.begin();
+    while (a != containers.end() || b != other.containers.end()) {
+        if (b == other.containers.end() || (a != containers.end() && a->key < b->key)) {
+            result.push_back(std::move(*a++));
+            continue;
+        }
+        if (a == containers.end() || b->key < a->key) {
+            result.push_back(*b++);
+            continue;
+        }
+        Container c = std::move(*a);
+        if (c.isBitset() || b->isBitset() || c.cardinality + b->cardinality > kArrayLimit) {
+            if (!c.isBitset()) toBitset(c);
+            if (b->isBitset()) {
+                for (size_t w = 0; w < 1024; ++w) c.bits[w] |= b->bits[w];
+            } else {
+                for (uint16_t low : b->array) c.bits[low >> 6] |= uint64_t{ 1 } << (low & 63);
             }
-            loan.renew(extraDays);
-            cout << "Da gia han phieu muon #" << loanId << " den ngay " << loan.getDueDate() << "\n";
-            return true;
+            c.cardinality = 0;
+            for (uint64_t word : c.bits) c.cardinality += __builtin_popcountll(word);
+            if (c.cardinality <= kArrayLimit) toArray(c);
+        } else {
+            vector<uint16_t> merged;
+            std::set_union(c.array.begin(), c.array.end(),
+                           b->array.begin(), b->array.end(),
+                           std::back_inserter(merged));
+            c.array.swap(merged);
+            c.cardinality = static_cast<int>(c.array.size());
         }
+        result.push_back(std::move(c));
+        ++a;
+        ++b;
     }
-    cout << "Khong tim thay phieu muon #" << loanId << "\n";
-    return false;
+    containers.swap(result);
+    return *this;
 }
 
-void LibrarySystem::updateOverdueAndSendReminders(int today) const {
-    cout << "=== Notifications & Reminders ===\n";
-    for (const auto& loan : loans) {
-        if (loan.getStatus() == LoanStatus::Active) {
-            int daysToDue = loan.getDueDate() - today;
-            if (daysToDue == 2) {
-                cout << "Nhac nho: Phieu muon #" << loan.getId()
-                     << " sap den han (con 2 ngay).\n";
-            } else if (daysToDue < 0) {
-                int overdueDays = -daysToDue;
-                cout << "Qua han: Phieu muon #" << loan.getId()
-                     << " da qua han " << overdueDays << " ngay.\n";
-            }
+
+vector<string> FacetIndex::tokenizeAuthor(const string& author) {
+    vector<string> tokens;
+    string current;
+    for (char ch : TrigramIndex::fold(author)) {
+        unsigned char u = static_cast<unsigned char>(ch);
+        if (u >= 0x80 || std::isalnum(u)) {
+            current += ch;
+        } else if (!current.empty()) {
+            tokens.push_back(current);
+            current.clear();
         }
     }
+    if (!current.empty()) tokens.push_back(current);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    return tokens;
 }
 
-Book* LibrarySystem::findBookById(int bookId) {
-    for (auto& b : books) {
-        if (b.getId() == bookId) return &b;
+void FacetIndex::add(const Book& book) {
+    uint32_t id = static_cast<uint32_t>(book.getId());
+    subjects[book.getSubject()].add(id);
+    years[book.getPublicationYear()].add(id);
+    for (const auto& token : tokenizeAuthor(book.getAuthor())) {
+        authorTokens[token].add(id);
     }
-    return nullptr;
 }
 
-const Book* LibrarySystem::findBookById(int bookId) const {
-    for (const auto& b : books) {
-        if (b.getId() == bookId) return &b;
+void FacetIndex::remove(const Book& book) {
+    uint32_t id = static_cast<uint32_t>(book.getId());
+    auto dropFrom = [id](auto& facet, const auto& key) {
+        auto it = facet.find(key);
+        if (it == facet.end()) return;
+        it->second.remove(id);
+        if (it->second.empty()) facet.erase(it);
+    };
+    dropFrom(subjects, book.getSubject());
+    dropFrom(years, book.getPublicationYear());
+    for (const auto& token : tokenizeAuthor(book.getAuthor())) {
+        dropFrom(authorTokens, token);
     }
-    return nullptr;
 }
 
-BookItem* LibrarySystem::findCopyById(int copyId) {
-    for (auto& c : copies) {
-        if (c.getId() == copyId) return &c;
+// searchBooks lọc chủ đề theo chuỗi con, nên gộp bitmap của mọi chủ đề chứa chuỗi đó.
+RoaringBitmap FacetIndex::subjectsContaining(const string& text) const {
+    RoaringBitmap result;
+    for (const auto& entry : subjects) {
+        if (entry.first.find(text) != string::npos) result |= entry.second;
     }
-    return nullptr;
+    return result;
 }
 
-const BookItem* LibrarySystem::findCopyById(int copyId) const {
-    for (const auto& c : copies) {
-        if (c.getId() == copyId) return &c;
+RoaringBitmap FacetIndex::match(const string& subjectText, int yearValue) const {
+    RoaringBitmap result;
+    bool restricted = false;
+    if (!subjectText.empty()) {
+        result = subjectsContaining(subjectText);
+        restricted = true;
     }
-    return nullptr;
-}
\ No newline at end of file
+    if (yearValue != 0) {
+        const RoaringBitmap* byYear = year(yearValue);
+        if (!byYear) return RoaringBitmap();
+        if (restricted) result &= *byYear;
+        else result = *byYear;
+    }
+    return result;
+}
+
+const RoaringBitmap* FacetIndex::subject(const string& value) const {
+    auto it = subjects.find(value);
+    return it == subjects.end() ? nullptr : &it->second;
+}
+
+const RoaringBitmap* FacetIndex::year(int value) const {
+    auto it = years.find(value);
+    return it == years.end() ? nullptr : &it->second;
+}
+
+const RoaringBitmap* FacetIndex::authorToken(const string& token) const {
+    auto it = authorTokens.find(token);
+    return it == authorTokens.end() ? nullptr : &it->second;
+}
+
+
+vector<string> PrefixIndex::words(const string& text) {
+    vector<string> result;
+    string current;
+    for (char ch : TrigramIndex::fold(text)) {
+        unsigned char u = static_cast<unsigned char>(ch);
+        if (u >= 0x80 || std::isalnum(u)) {
+            current += ch;
+        } else if (!current.empty()) {
+            result.push_back(current);
+            current.clear();
+        }
+    }
+    if (!current.empty()) result.push_back(current);
+    return result;
+}
+
+namespace {
+    vector<string> bookTerms(const Book& book) {
+        vector<string> result = PrefixIndex::words(book.getTitle());
+        vector<string> authorWords = PrefixIndex::words(book.getAuthor());
+        result.insert(result.end(), authorWords.begin(), authorWords.end());
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+}
+
+void PrefixIndex::add(const Book& book) {
+    int bookId = book.getId();
+    for (const auto& term : bookTerms(book)) {
+        vector<int>& list = terms[term];
+        if (list.empty() || list.back() < bookId) {
+            list.push_back(bookId);
+        } else {
+            auto it = std::lower_bound(list.begin(), list.end(), bookId);
+            if (it == list.end() || *it != bookId) list.insert(it, bookId);
+        }
+    }
+}
+
+void PrefixIndex::remove(const Book& book) {
+    int bookId = book.getId();
+    for (const auto& term : bookTerms(book)) {
+        auto found = terms.find(term);
+        if (found == terms.end()) continue;
+        vector<int>& list = found->second;
+        auto it = std::lower_bound(list.begin(), list.end(), bookId);
+        if (it != list.end() && *it == bookId) list.erase(it);
+        if (list.empty()) terms.erase(found);
+    }
+}
+
+const vector<int>* PrefixIndex::postings(const string& term) const {
+    auto it = terms.find(term);
+    return it == terms.end() ? nullptr : &it->second;
+}
+
+
+namespace {
+    // Chữ cái gốc (ASCII thường) của một ký tự Latin có dấu; 0 nếu không cần đổi.
+    char baseLetter(uint32_t cp) {
+        if (cp >= 0xC0 && cp <= 0xFF) {
+            static const char latin1[] =
+                "aaaaaaaceeeeiiii" "dnooooo\0ouuuuy\0\0"
+                "aaaaaaaceeeeiiii" "dnooooo\0ouuuuy\0y";
+            return latin1[cp - 0xC0];
+        }
+        switch (cp) {
+            case 0x102: case 0x103: return 'a';
+            case 0x110: case 0x111: return 'd';
+            case 0x128: case 0x129: return 'i';
+            case 0x168: case 0x169: return 'u';
+            case 0x1A0: case 0x1A1: return 'o';
+            case 0x1AF: case 0x1B0: return 'u';
+            default: break;
+        }
+        if (cp >= 0x1EA0 && cp <= 0x1EB7) return 'a';
+        if (cp >= 0x1EB8 && cp <= 0x1EC7) return 'e';
+        if (cp >= 0x1EC8 && cp <= 0x1ECB) return 'i';
+        if (cp >= 0x1ECC && cp <= 0x1EE3) return 'o';
+        if (cp >= 0x1EE4 && cp <= 0x1EF1) return 'u';
+        if (cp >= 0x1EF2 && cp <= 0x1EF9) return 'y';
+        return 0;
+    }
+}
+
+// Hạ chữ thường và bỏ dấu tiếng Việt (cả dạng dựng sẵn lẫn dấu kết hợp U+0300..U+036F).
+string FuzzyIndex::foldVietnamese(const string& text) {
+    string folded;
+    folded.reserve(text.size());
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char lead = static_cast<unsigned char>(text[i]);
+        size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 1;
+        if (i + length > text.size()) length = 1;
+        uint32_t cp = lead;
+        if (length > 1) {
+            cp = lead & (0xFF >> (length + 1));
+            for (size_t k = 1; k < length; ++k) {
+                cp = (cp << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+            }
+        }
+        if (length == 1) {
+            folded += (lead >= 'A' && lead <= 'Z') ? static_cast<char>(lead - 'A' + 'a') : text[i];
+        } else if (cp >= 0x300 && cp <= 0x36F) {
+            // dấu kết hợp: bỏ
+        } else if (char base = baseLetter(cp)) {
+            folded += base;
+        } else {
+            folded.append(text, i, length);
+        }
+        i += length;
+    }
+    return folded;
+}
+
+int FuzzyIndex::editDistance(const string& a, const string& b) {
+    vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) row[j] = static_cast<int>(j);
+    for (size_t i = 1; i <= a.size(); ++i) {
+        int diagonal = row[0];
+        row[0] = static_cast<int>(i);
+        for (size_t j = 1; j <= b.size(); ++j) {
+            int above = row[j];
+            row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] == b[j - 1] ? 0 : 1) });
+            diagonal = above;
+        }
+    }
+    return row[b.size()];
+}
+
+int FuzzyIndex::maxDistanceFor(const string& word) {
+    if (word.size() <= 1) return 0;
+    if (word.size() <= 4) return 1;
+    return 2;
+}
+
+vector<string> FuzzyIndex::termsOf(const Book& book) {
+    vector<string> result = PrefixIndex::words(foldVietnamese(book.getTitle()));
+    vector<string> authorWords = PrefixIndex::words(foldVietnamese(book.getAuthor()));
+    result.insert(result.end(), authorWords.begin(), authorWords.end());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+int FuzzyIndex::internTerm(const string& term) {
+    auto found = termIds.find(term);
+    if (found != termIds.end()) return found->second;
+
+    int termId = static_cast<int>(termTexts.size());
+    termTexts.push_back(term);
+    termPostings.emplace_back();
+    termIds.emplace(term, termId);
+
+    int nodeIndex = static_cast<int>(tree.size());
+    tree.push_back({ termId, {} });
+    if (nodeIndex == 0) return termId;
+    int current = 0;
+    while (true) {
+        int d = editDistance(term, termTexts[tree[current].termId]);
+        auto& children = tree[current].children;
+        auto child = std::find_if(children.begin(), children.end(),
+            [d](const std::pair<int, int>& c) { return c.first == d; });
+        if (child == children.end()) {
+            children.emplace_back(d, nodeIndex);
+            return termId;
+        }
+        current = child->second;
+    }
+}
+
+void FuzzyIndex::add(const Book& book) {
+    int bookId = book.getId();
+    for (const auto& term : termsOf(book)) {
+        vector<int>& list = termPostings[internTerm(term)];
+        if (list.empty() || list.back() < bookId) {
+            list.push_back(bookId);
+        } else {
+            auto it = std::lower_bound(list.begin(), list.end(), bookId);
+            if (it == list.end() || *it != bookId) list.insert(it, bookId);
+        }
+    }
+}
+
+// Từ không còn sách nào vẫn nằm lại trong cây BK (danh sách rỗng), vì gỡ nút khỏi
+// cây BK phải dựng lại cả nhánh con.
+void FuzzyIndex::remove(const Book& book) {
+    int bookId = book.getId();
+    for (const auto& term : termsOf(book)) {
+        auto found = termIds.find(term);
+        if (found == termIds.end()) continue;
+        vector<int>& list = termPostings[found->second];
+        auto it = std::lower_bound(list.begin(), list.end(), bookId);
+        if (it != list.end() && *it == bookId) list.erase(it);
+    }
+}
+
+
+void IdTable::set(int id, int position) {
+    if (id <= 0) return;
+    if (static_cast<size_t>(id) >= slots.size()) {
+        slots.resize(static_cast<size_t>(id) + 1, -1);
+    }
+    slots[id] = position;
+}
+
+void IdTable::erase(int id) {
+    if (id > 0 && static_cast<size_t>(id) < slots.size()) {
+        slots[id] = -1;
+    }
+}
+
+int IdTable::find(int id) const {
+    if (id <= 0 || static_cast<size_t>(id) >= slots.size()) return -1;
+    return slots[id];
+}
+
+
+LibrarySystem::LibrarySystem() {
+
+}
+
+LibrarySystem::~LibrarySystem() {
+    if (catalogLoader.joinable()) catalogLoader.join();
+}
+
+CatalogLoadStatus LibrarySystem::catalogLoadStatus() const {
+    CatalogLoadStatus status;
+    status.loading = isCatalogLoading();
+    status.booksLoaded = status.loading ? catalogBooksLoaded.load(std::memory_order_relaxed) : books.size() - removedBooks;
+    status.booksTotal = status.loading ? catalogBooksTotal : books.size() - removedBooks;
+    return status;
+}
+
+// Chặn cho tới khi luồng nạp nền xong. Không chờ nếu chính luồng này đang giữ khoá
+// catalog (luồng nạp, hoặc lời gọi lồng trong một truy vấn từng phần).
+void LibrarySystem::waitForCatalog() const {
+    if (!isCatalogLoading() || catalogLockDepth > 0) return;
+    std::unique_lock<std::mutex> lock(catalogReadyMutex);
+    catalogReadyCv.wait(lock, [this] { return !isCatalogLoading(); });
+}
+
+// Luồng nạp nhả khoá ghi giữa các lô để truy vấn đang chờ được chạy.
+void LibrarySystem::yieldCatalogLock() {
+    if (!loaderLock) return;
+    catalogBooksLoaded.store(books.size(), std::memory_order_relaxed);
+    loaderLock->unlock();
+    std::this_thread::yield();
+    loaderLock->lock();
+}
+
+void LibrarySystem::finishCatalogLoad() {
+    {
+        std::lock_guard<std::mutex> lock(catalogReadyMutex);
+        catalogReady.store(true, std::memory_order_release);
+    }
+    catalogReadyCv.notify_all();
+}
+
+MemberAccount* LibrarySystem::registerMember(
+    const string& fullName,
+    const string& dob,
+    Gender gender,
+    const string& address,
+    const string& phone,
+    const string& email,
+    const string& password,
+    NotificationPreference pref,
+    AccountRole role) {
+    ScopedTimer timer(metrics, MetricOp::RegisterMember);
+    TraceSpan span("registerMember");
+
+    if (findMemberByEmail(email) != nullptr) {
+        report(EventCode::EmailAlreadyExists, 0, 0, 0, email);
+        return nullptr;
+    }
+
+    if (password.size() < 6) {
+        report(EventCode::PasswordTooShort, 0, 6);
+        return nullptr;
+    }
+
+    LibraryCard card;
+    card.cardNumber = "CARD-" + std::to_string(nextMemberId);
+    card.issuedDate = "Today";
+    card.active = true;
+
+    MemberAccount& m = insertMember(MemberAccount(nextMemberId,
+        fullName, dob, gender, address, phone, email, password, pref, card, role));
+    logRegisterMember(m);
+
+    report(EventCode::MemberRegistered, m.getId(), 0, 0, card.cardNumber);
+    return &m;
+}
+
+void LibrarySystem::logRegisterMember(const MemberAccount& m) {
+    if (!journaling()) return;
+    JournalRecord record;
+    record.putInt(OpRegisterMember).putInt(m.getId())
+          .putString(m.getName()).putString(m.getDateOfBirth()).putInt(static_cast<int>(m.getGender()))
+          .putString(m.getAddress()).putString(m.getPhone()).putString(m.getEmail())
+          .putString(m.getPasswordHash()).putInt(static_cast<int>(m.getPreference()))
+          .putInt(static_cast<int>(m.getRole()));
+    logMutation(record);
+}
+
+// Thêm tài khoản đã dựng sẵn (id lấy từ account) vào deque và các chỉ mục.
+MemberAccount& LibrarySystem::insertMember(MemberAccount account) {
+    int memberId = account.getId();
+    nextMemberId = std::max(nextMemberId, memberId + 1);
+    members.push_back(std::move(account));
+    int position = static_cast<int>(members.size() - 1);
+    memberTable.set(memberId, position);
+    emailIndex.emplace(members.back().getEmail(), position);
+    return members.back();
+}
+
+bool LibrarySystem::removeMember(std::string_view email) {
+    waitForCatalog();
+    auto it = emailIndex.find(email);
+    if (it == emailIndex.end()) return false;
+    if (countBorrowedItems(members[it->second].getId()) > 0) {
+        report(EventCode::MemberHasOpenLoans, members[it->second].getId(), 0, 0, string(email));
+        return false;
+    }
+    memberTable.erase(members[it->second].getId());
+    emailIndex.erase(it);
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpRemoveMember).putString(string(email));
+        logMutation(record);
+    }
+    return true;
+}
+
+MemberAccount* LibrarySystem::findMemberByEmail(std::string_view email) {
+    auto it = emailIndex.find(email);
+    return it == emailIndex.end() ? nullptr : &members[it->second];
+}
+
+const MemberAccount* LibrarySystem::findMemberByEmail(std::string_view email) const {
+    auto it = emailIndex.find(email);
+    return it == emailIndex.end() ? nullptr : &members[it->second];
+}
+
+MemberAccount* LibrarySystem::findMemberById(int memberId) {
+    int position = memberTable.find(memberId);
+    return position < 0 ? nullptr : &members[position];
+}
+
+std::future<bool> LibrarySystem::verifyPasswordAsync(const MemberAccount& member, const string& password) const {
+    std::call_once(loginPoolOnce, [this] {
+        loginPool = std::make_unique<ThreadPool>(kLoginPoolThreads);
+    });
+    auto task = std::make_shared<std::packaged_task<bool()>>(
+        [password, stored = member.getPasswordHash()] { return PasswordHasher::verify(password, stored); });
+    std::future<bool> verdict = task->get_future();
+    loginPool->submit([task] { (*task)(); });
+    return verdict;
+}
+
+MemberAccount* LibrarySystem::login(const string& email, const string& password) {
+    ScopedTimer timer(metrics, MetricOp::Login);
+    TraceSpan span("login");
+    MemberAccount* m = findMemberByEmail(email);
+    if (!m) {
+
+        return nullptr;
+    }
+    if (!verifyPasswordAsync(*m, password).get()) {
+        // cout << "Sai mat khau.\n";
+        return nullptr;
+    }
+    // Hash kiểu cũ hoặc ít vòng hơn cấu hình hiện tại được băm lại ngay khi có mật khẩu gốc.
+    if (PasswordHasher::needsRehash(m->getPasswordHash())) {
+        m->changePassword(password);
+        if (journaling()) {
+            JournalRecord record;
+            record.putInt(OpChangePassword).putInt(m->getId()).putString(m->getPasswordHash());
+            logMutation(record);
+        }
+    }
+    // Giao diện main sẽ in thông báo chào mừng
+    return m;
+}
+
+void LibrarySystem::forgotPassword(const string& email, const string& newPassword) {
+    MemberAccount* m = findMemberByEmail(email);
+    if (!m) {
+        report(EventCode::EmailNotRegistered, 0, 0, 0, email);
+        return;
+    }
+    report(EventCode::PasswordResetSent, m->getId(), 0, 0, email);
+    m->changePassword(newPassword);
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpChangePassword).putInt(m->getId()).putString(m->getPasswordHash());
+        logMutation(record);
+    }
+    report(EventCode::PasswordChanged, m->getId());
+}
+
+void LibrarySystem::indexBook(const Book& book) {
+    isbnIndex.emplace(book.getIsbn(), book.getId());
+    if (!searchIndexesStale.load(std::memory_order_relaxed)) addToSearchIndexes(book);
+}
+
+void LibrarySystem::addToSearchIndexes(const Book& book) const {
+    keywordIndex.add(book.getId(), TrigramIndex::bookText(book));
+    facetIndex.add(book);
+    prefixIndex.add(book);
+    fuzzyIndex.add(book);
+}
+
+void LibrarySystem::removeFromSearchIndexes(const Book& book) {
+    if (searchIndexesStale.load(std::memory_order_relaxed)) return;
+    keywordIndex.remove(book.getId());
+    facetIndex.remove(book);
+    prefixIndex.remove(book);
+    fuzzyIndex.remove(book);
+}
+
+// Sau loadSnapshot / nhập lớn các chỉ mục tìm kiếm bị bỏ qua; lần tìm kiếm đầu tiên dựng
+// lại chúng từ books hiện tại (đã gồm cả sách thêm/sửa/xoá trong lúc chờ). Chỉ mục có
+// thể còn dữ liệu cũ từ trước khi bị bỏ qua nên phải xoá trắng trước khi dựng.
+void LibrarySystem::ensureSearchIndexes() const {
+    if (!searchIndexesStale.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(searchIndexMutex);
+    if (!searchIndexesStale.load(std::memory_order_relaxed)) return;
+    TraceSpan span("buildSearchIndexes");
+    // Bốn chỉ mục độc lập nhau nên dựng song song, mỗi chỉ mục trên một luồng.
+    sharedPool().parallelFor(4, [this](size_t index) {
+        switch (index) {
+        case 0: keywordIndex.clear(); break;
+        case 1: facetIndex.clear(); break;
+        case 2: prefixIndex.clear(); break;
+        default: fuzzyIndex.clear(); break;
+        }
+        for (const auto& b : books) {
+            if (b.isRemoved()) continue;
+            switch (index) {
+            case 0: keywordIndex.add(b.getId(), TrigramIndex::bookText(b)); break;
+            case 1: facetIndex.add(b); break;
+            case 2: prefixIndex.add(b); break;
+            default: fuzzyIndex.add(b); break;
+            }
+        }
+    });
+    searchIndexesStale.store(false, std::memory_order_release);
+}
+
+Book* LibrarySystem::addBook(const string& isbn,
+                             const string& title,
+                             const string& author,
+                             const string& subject,
+                             int publicationYear,
+                             const string& language,
+                             int pages,
+                             const string& rackPosition,
+                             const string& description,
+                             int numCopies) {
+    waitForCatalog();
+    int bookId = nextBookId++;
+    books.emplace_back(bookId, isbn, title, author, subject,
+                       publicationYear, language, pages, rackPosition, description);
+    bookTable.set(bookId, static_cast<int>(books.size() - 1));
+    indexBook(books.back());
+    ++catalogGeneration;
+
+    int firstCopyId = nextCopyId;
+    insertCopies(bookId, numCopies, rackPosition);
+
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpAddBook).putInt(bookId).putInt(firstCopyId)
+              .putString(isbn).putString(title).putString(author).putString(subject)
+              .putInt(publicationYear).putString(language).putInt(pages)
+              .putString(rackPosition).putString(description).putInt(numCopies);
+        logMutation(record);
+    }
+
+    return &books.back();
+}
+
+// Bản sao của một đầu sách được cấp id liên tiếp và nằm liền nhau trong copies.
+void LibrarySystem::insertCopies(int bookId, int numCopies, const string& rackPosition) {
+    if (static_cast<size_t>(bookId) >= copyGroups.size()) {
+        copyGroups.resize(static_cast<size_t>(bookId) + 1);
+    }
+    copyGroups[bookId] = CopyGroup(nextCopyId, std::max(numCopies, 0));
+    for (int i = 0; i < numCopies; ++i) {
+        string barcode = "BC-" + std::to_string(bookId) + "-" + std::to_string(i + 1);
+        int copyId = nextCopyId++;
+        barcodeIndex[barcode] = copyId;
+        copies.emplace_back(copyId, bookId, std::move(barcode), true, rackPosition);
+        copyTable.set(copyId, static_cast<int>(copies.size() - 1));
+    }
+}
+
+bool LibrarySystem::editBook(int bookId,
+                             const string& title,
+                             const string& author,
+                             const string& subject,
+                             int publicationYear,
+                             const string& language,
+                             int pages,
+                             const string& rackPosition,
+                             const string& description) {
+    waitForCatalog();
+    Book* b = findBookById(bookId);
+    if (!b) return false;
+    removeFromSearchIndexes(*b);
+    b->updateInfo(title, author, subject, publicationYear, language, pages, rackPosition, description);
+    if (!searchIndexesStale.load(std::memory_order_relaxed)) addToSearchIndexes(*b);
+    ++catalogGeneration;
+    const CopyGroup* group = findCopyGroup(bookId);
+    for (int i = 0; group && i < group->getTotal(); ++i) {
+        BookItem* c = findCopyById(group->getFirstCopyId() + i);
+        if (c) {
+            *c = BookItem(c->getId(), c->getBookId(), c->getBarcode(), c->isAvailable(), rackPosition);
+        }
+    }
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpEditBook).putInt(bookId)
+              .putString(title).putString(author).putString(subject).putInt(publicationYear)
+              .putString(language).putInt(pages).putString(rackPosition).putString(description);
+        logMutation(record);
+    }
+    return true;
+}
+
+bool LibrarySystem::removeBook(int bookId) {
+    TraceSpan span("removeBook");
+    waitForCatalog();
+    int position = bookTable.find(bookId);
+    if (position < 0) return false;
+
+    if (isBookOnLoan(bookId)) {
+        report(EventCode::BookOnLoan, bookId);
+        return false;
+    }
+
+    auto isbnRange = isbnIndex.equal_range(books[position].getIsbn());
+    for (auto it = isbnRange.first; it != isbnRange.second; ++it) {
+        if (it->second == bookId) {
+            isbnIndex.erase(it);
+            break;
+        }
+    }
+    removeFromSearchIndexes(books[position]);
+    bookTable.erase(bookId);
+    books[position].markRemoved();
+    ++removedBooks;
+    ++catalogGeneration;
+
+    // Bản sao của một đầu sách nằm liền nhau trong vector copies nên xoá theo đoạn.
+    CopyGroup& group = copyGroups[bookId];
+    int firstPosition = copyTable.find(group.getFirstCopyId());
+    if (firstPosition >= 0) {
+        for (int i = 0; i < group.getTotal(); ++i) {
+            BookItem& copy = copies[firstPosition + i];
+            copyTable.erase(copy.getId());
+            barcodeIndex.erase(copy.getBarcode());
+            copy.markRemoved();
+        }
+        removedCopies += static_cast<size_t>(group.getTotal());
+    }
+    group = CopyGroup();
+
+    // Xoá chỉ đánh dấu; dồn vector khi phần đã xoá vượt nửa nên mỗi lần xoá vẫn O(1) trung bình.
+    // Không dồn khi đang nạp nền: các trang từng phần đã trả con trỏ Book cho người gọi,
+    // việc dồn để dành cho lần xoá đầu tiên sau khi nạp xong.
+    if (removedBooks > books.size() / 2 && !isCatalogLoading()) compactCatalog();
+
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpRemoveBook).putInt(bookId);
+        logMutation(record);
+    }
+    return true;
+}
+
+// Bỏ các sách / bản sao đã xoá rồi cập nhật lại vị trí trong bảng id. Thứ tự id
+// được giữ nguyên nên các phép tìm nhị phân trên books vẫn đúng.
+void LibrarySystem::compactCatalog() {
+    books.erase(std::remove_if(books.begin(), books.end(),
+        [](const Book& b) { return b.isRemoved(); }), books.end());
+    copies.erase(std::remove_if(copies.begin(), copies.end(),
+        [](const BookItem& c) { return c.isRemoved(); }), copies.end());
+    for (size_t i = 0; i < books.size(); ++i) {
+        bookTable.set(books[i].getId(), static_cast<int>(i));
+    }
+    for (size_t i = 0; i < copies.size(); ++i) {
+        copyTable.set(copies[i].getId(), static_cast<int>(i));
+    }
+    removedBooks = 0;
+    removedCopies = 0;
+}
+
+namespace {
+    const size_t kParallelSearchThreshold = 50000;
+    const size_t kParallelSearchChunk = 8192;
+
+    bool matchesLoadedBook(const Book& b, const string& lowerKey, const string& author,
+                           const string& subject, int year) {
+        if (b.isRemoved()) return false;
+        if (year != 0 && b.getPublicationYear() != year) return false;
+        if (!subject.empty() && b.getSubject().find(subject) == string::npos) return false;
+        if (!author.empty() && b.getAuthor().find(author) == string::npos) return false;
+        return lowerKey.empty() || TrigramIndex::bookText(b).find(lowerKey) != string::npos;
+    }
+}
+
+vector<int> LibrarySystem::searchBooks(const string& keyword,
+                                       const string& author,
+                                       const string& subject,
+                                       int year,
+                                       SearchMode mode) const {
+    ScopedTimer timer(metrics, MetricOp::SearchBooks);
+    TraceSpan span("searchBooks");
+    thread_local string lowerKey;
+    TrigramIndex::foldInto(keyword, lowerKey);
+    if (isCatalogLoading()) {
+        CatalogReadLock lock(catalogMutex, true);
+        return scanLoadedBooks(lowerKey, author, subject, year);
+    }
+    ensureSearchIndexes();
+    string key = QueryCache::makeKey(lowerKey, author, subject, year, mode);
+    vector<int> resultIds;
+    if (queryCache.find(key, catalogGeneration, resultIds)) return resultIds;
+    resultIds = searchBooksUncached(lowerKey, author, subject, year, mode);
+    queryCache.store(key, catalogGeneration, resultIds);
+    return resultIds;
+}
+
+vector<int> LibrarySystem::searchBooksUncached(const string& lowerKey,
+                                               const string& author,
+                                               const string& subject,
+                                               int year,
+                                               SearchMode mode) const {
+    vector<int> resultIds;
+    bool useFacets = !subject.empty() || year != 0;
+
+    auto matchesAuthor = [&](int bookId) {
+        if (author.empty()) return true;
+        const Book* b = findBookById(bookId);
+        return b && b->getAuthor().find(author) != string::npos;
+    };
+
+    if (!lowerKey.empty() && mode == SearchMode::Auto && lowerKey.size() >= TrigramIndex::kGramSize) {
+        if (keywordIndex.search(lowerKey, resultIds)) {
+            RoaringBitmap facetFilter;
+            if (useFacets) facetFilter = facetIndex.match(subject, year);
+            resultIds.erase(std::remove_if(resultIds.begin(), resultIds.end(), [&](int bookId) {
+                if (useFacets && !facetFilter.contains(static_cast<uint32_t>(bookId))) return true;
+                return !matchesAuthor(bookId);
+            }), resultIds.end());
+            return resultIds;
+        }
+        resultIds.clear();
+    }
+
+    if (useFacets && mode == SearchMode::Auto) {
+        // Bitmap facet đã thu hẹp tập ứng viên: kiểm tra từ khoá trên từng bản ghi.
+        facetIndex.match(subject, year).forEach([&](uint32_t bookId) {
+            int id = static_cast<int>(bookId);
+            if (!lowerKey.empty() && !keywordIndex.textContains(id, lowerKey)) return;
+            if (matchesAuthor(id)) resultIds.push_back(id);
+        });
+        return resultIds;
+    }
+
+    if (books.size() >= kParallelSearchThreshold) {
+        return parallelScan(lowerKey, author, subject, year);
+    }
+    if (!lowerKey.empty()) {
+        keywordIndex.scan(lowerKey, resultIds);
+        resultIds.erase(std::remove_if(resultIds.begin(), resultIds.end(), [&](int bookId) {
+            const Book* b = findBookById(bookId);
+            if (!b) return true;
+            if (!subject.empty() && b->getSubject().find(subject) == string::npos) return true;
+            if (year != 0 && b->getPublicationYear() != year) return true;
+            return !matchesAuthor(bookId);
+        }), resultIds.end());
+    } else {
+        for (const auto& b : books) {
+            if (b.isRemoved()) continue;
+            if (!subject.empty() && b.getSubject().find(subject) == string::npos) continue;
+            if (year != 0 && b.getPublicationYear() != year) continue;
+            if (matchesAuthor(b.getId())) resultIds.push_back(b.getId());
+        }
+    }
+    return resultIds;
+}
+
+// Dùng khi catalog còn đang nạp nền: chỉ mục tìm kiếm chưa dựng nên so khớp trực
+// tiếp trên từng sách đã nạp. Người gọi giữ khoá đọc catalog.
+vector<int> LibrarySystem::scanLoadedBooks(const string& lowerKey,
+                                           const string& author,
+                                           const string& subject,
+                                           int year) const {
+    vector<int> resultIds;
+    for (const auto& b : books) {
+        if (!matchesLoadedBook(b, lowerKey, author, subject, year)) continue;
+        resultIds.push_back(b.getId());
+    }
+    return resultIds;
+}
+
+ThreadPool& LibrarySystem::sharedPool() const {
+    std::call_once(workerPoolOnce, [this] {
+        workerPool = std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    });
+    return *workerPool;
+}
+
+// Chia vector books (đã theo thứ tự id) thành các đoạn, mỗi đoạn lọc trên một luồng;
+// ghép kết quả theo thứ tự đoạn nên danh sách trả về vẫn tăng dần theo id.
+vector<int> LibrarySystem::parallelScan(const string& foldedKeyword,
+                                        const string& author,
+                                        const string& subject,
+                                        int year) const {
+    size_t chunks = (books.size() + kParallelSearchChunk - 1) / kParallelSearchChunk;
+    vector<vector<int>> partial(chunks);
+    sharedPool().parallelFor(chunks, [&](size_t chunk) {
+        size_t begin = chunk * kParallelSearchChunk;
+        size_t end = std::min(books.size(), begin + kParallelSearchChunk);
+        for (size_t i = begin; i < end; ++i) {
+            const Book& b = books[i];
+            if (b.isRemoved()) continue;
+            if (year != 0 && b.getPublicationYear() != year) continue;
+            if (!subject.empty() && b.getSubject().find(subject) == string::npos) continue;
+            if (!author.empty() && b.getAuthor().find(author) == string::npos) continue;
+            if (!foldedKeyword.empty() && !keywordIndex.textContains(b.getId(), foldedKeyword)) continue;
+            partial[chunk].push_back(b.getId());
+        }
+    });
+
+    vector<int> resultIds;
+    for (const auto& ids : partial) {
+        resultIds.insert(resultIds.end(), ids.begin(), ids.end());
+    }
+    return resultIds;
+}
+
+// Trả về tối đa limit kết quả có id > afterId. Khi phải quét, dừng ngay khi đủ trang
+// nên từ khoá ngắn trên catalog lớn vẫn có trang đầu tức thì.
+SearchPage LibrarySystem::searchBooksPage(const string& keyword,
+                                          const string& author,
+                                          const string& subject,
+                                          int year,
+                                          size_t limit,
+                                          int afterId) const {
+    ScopedTimer timer(metrics, MetricOp::SearchBooksPage);
+    TraceSpan span("searchBooksPage");
+    SearchPage page;
+    if (limit == 0) return page;
+
+    auto emit = [&](const Book& b) {
+        if (page.hits.size() == limit) {
+            page.nextCursor = page.hits.back().book->getId();
+            return false;
+        }
+        page.hits.push_back({ &b, countAvailableCopies(b.getId()) });
+        return true;
+    };
+
+    string lowerKey = TrigramIndex::fold(keyword);
+    if (isCatalogLoading()) {
+        CatalogReadLock lock(catalogMutex, true);
+        page.partial = true;
+        auto start = std::upper_bound(books.begin(), books.end(), afterId,
+            [](int id, const Book& b) { return id < b.getId(); });
+        for (auto it = start; it != books.end(); ++it) {
+            if (!matchesLoadedBook(*it, lowerKey, author, subject, year)) continue;
+            if (!emit(*it)) break;
+        }
+        return page;
+    }
+    ensureSearchIndexes();
+    vector<int> candidates;
+    bool indexed = !subject.empty() || year != 0;
+    if (indexed) {
+        candidates = searchBooks(keyword, author, subject, year);
+    } else if (lowerKey.size() >= TrigramIndex::kGramSize && keywordIndex.search(lowerKey, candidates)) {
+        indexed = true;
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](int bookId) {
+            const Book* b = findBookById(bookId);
+            return !b || (!author.empty() && b->getAuthor().find(author) == string::npos);
+        }), candidates.end());
+    }
+
+    if (indexed) {
+        for (auto it = std::upper_bound(candidates.begin(), candidates.end(), afterId);
+             it != candidates.end(); ++it) {
+            const Book* b = findBookById(*it);
+            if (b && !emit(*b)) break;
+        }
+        return page;
+    }
+
+    auto start = std::upper_bound(books.begin(), books.end(), afterId,
+        [](int id, const Book& b) { return id < b.getId(); });
+    for (auto it = start; it != books.end(); ++it) {
+        if (it->isRemoved()) continue;
+        if (!author.empty() && it->getAuthor().find(author) == string::npos) continue;
+        if (!lowerKey.empty() && !keywordIndex.textContains(it->getId(), lowerKey)) continue;
+        if (!emit(*it)) break;
+    }
+    return page;
+}
+
+FacetResult LibrarySystem::searchFacets(const FacetQuery& query) const {
+    ScopedTimer timer(metrics, MetricOp::SearchFacets);
+    TraceSpan span("searchFacets");
+    waitForCatalog();
+    ensureSearchIndexes();
+    RoaringBitmap matched;
+    bool restricted = false;
+    auto restrictTo = [&](const RoaringBitmap* bitmap) {
+        if (!bitmap) matched = RoaringBitmap();
+        else if (!restricted) matched = *bitmap;
+        else matched &= *bitmap;
+        restricted = true;
+    };
+    if (!query.subject.empty()) restrictTo(facetIndex.subject(query.subject));
+    if (query.year != 0) restrictTo(facetIndex.year(query.year));
+    if (!query.authorToken.empty()) {
+        restrictTo(facetIndex.authorToken(TrigramIndex::fold(query.authorToken)));
+    }
+
+    FacetResult result;
+    std::map<string, int> subjectCounts;
+    std::map<int, int> yearCounts;
+    std::map<string, int> authorCounts;
+    auto tally = [&](int bookId) {
+        const Book* b = findBookById(bookId);
+        if (!b) return;
+        result.bookIds.push_back(bookId);
+        ++subjectCounts[b->getSubject()];
+        ++yearCounts[b->getPublicationYear()];
+        for (const auto& token : FacetIndex::tokenizeAuthor(b->getAuthor())) {
+            ++authorCounts[token];
+        }
+    };
+
+    if (!query.keyword.empty()) {
+        for (int bookId : searchBooks(query.keyword, "", "", 0)) {
+            if (!restricted || matched.contains(static_cast<uint32_t>(bookId))) tally(bookId);
+        }
+    } else if (restricted) {
+        matched.forEach([&](uint32_t bookId) { tally(static_cast<int>(bookId)); });
+    } else {
+        for (const auto& b : books) tally(b.getId());
+    }
+
+    auto sortedCounts = [](vector<FacetCount>& counts) {
+        std::sort(counts.begin(), counts.end(), [](const FacetCount& a, const FacetCount& b) {
+            return a.count != b.count ? a.count > b.count : a.value < b.value;
+        });
+    };
+    for (const auto& entry : subjectCounts) result.subjects.push_back({ entry.first, entry.second });
+    for (const auto& entry : yearCounts) result.years.push_back({ std::to_string(entry.first), entry.second });
+    for (const auto& entry : authorCounts) result.authorTokens.push_back({ entry.first, entry.second });
+    sortedCounts(result.subjects);
+    sortedCounts(result.years);
+    sortedCounts(result.authorTokens);
+    return result;
+}
+
+// Các từ đã gõ xong phải khớp nguyên từ; từ cuối (chưa có dấu cách phía sau) khớp
+// theo tiền tố. Dừng ngay khi đủ limit gợi ý nên không phụ thuộc kích thước kho sách.
+vector<Suggestion> LibrarySystem::autocomplete(const string& typed, size_t limit) const {
+    ScopedTimer timer(metrics, MetricOp::Autocomplete);
+    TraceSpan span("autocomplete");
+    waitForCatalog();
+    ensureSearchIndexes();
+    vector<Suggestion> result;
+    vector<string> typedWords = PrefixIndex::words(typed);
+    if (typedWords.empty() || limit == 0) return result;
+
+    string prefix;
+    unsigned char last = static_cast<unsigned char>(typed.back());
+    if (last >= 0x80 || std::isalnum(last)) {
+        prefix = typedWords.back();
+        typedWords.pop_back();
+    }
+
+    vector<const vector<int>*> required;
+    for (const auto& word : typedWords) {
+        const vector<int>* list = prefixIndex.postings(word);
+        if (!list) return result;
+        required.push_back(list);
+    }
+    if (prefix.empty()) {
+        // Người dùng vừa gõ xong một từ: gợi ý theo đúng từ đó.
+        prefix = typedWords.back();
+        required.pop_back();
+    }
+
+    vector<int> seen;
+    prefixIndex.forEachCompletion(prefix, [&](const string& term, int bookId) {
+        if (std::find(seen.begin(), seen.end(), bookId) != seen.end()) return true;
+        for (const vector<int>* list : required) {
+            if (!std::binary_search(list->begin(), list->end(), bookId)) return true;
+        }
+        const Book* b = findBookById(bookId);
+        if (!b) return true;
+        seen.push_back(bookId);
+        result.push_back({ bookId, term, b->getTitle(), b->getAuthor(), countAvailableCopies(bookId) });
+        return result.size() < limit;
+    });
+    return result;
+}
+
+// Mỗi từ của truy vấn phải khớp gần đúng một từ trong tên sách hoặc tác giả;
+// điểm của sách là tổng khoảng cách nhỏ nhất của từng từ.
+vector<FuzzyMatch> LibrarySystem::fuzzySearch(const string& text, size_t limit) const {
+    ScopedTimer timer(metrics, MetricOp::FuzzySearch);
+    TraceSpan span("fuzzySearch");
+    waitForCatalog();
+    ensureSearchIndexes();
+    vector<FuzzyMatch> result;
+    vector<string> queryWords = PrefixIndex::words(FuzzyIndex::foldVietnamese(text));
+    if (queryWords.empty() || limit == 0) return result;
+
+    std::unordered_map<int, int> scores;
+    for (size_t w = 0; w < queryWords.size(); ++w) {
+        std::unordered_map<int, int> best;
+        fuzzyIndex.forEachNear(queryWords[w], FuzzyIndex::maxDistanceFor(queryWords[w]),
+            [&](const vector<int>& bookIds, int distance) {
+                for (int bookId : bookIds) {
+                    if (w > 0 && scores.find(bookId) == scores.end()) continue;
+                    auto it = best.find(bookId);
+                    if (it == best.end() || distance < it->second) best[bookId] = distance;
+                }
+            });
+        if (w == 0) {
+            scores.swap(best);
+        } else {
+            std::unordered_map<int, int> next;
+            for (const auto& entry : best) next[entry.first] = scores[entry.first] + entry.second;
+            scores.swap(next);
+        }
+        if (scores.empty()) return result;
+    }
+
+    for (const auto& entry : scores) result.push_back({ entry.first, entry.second });
+    std::sort(result.begin(), result.end(), [](const FuzzyMatch& a, const FuzzyMatch& b) {
+        return a.distance != b.distance ? a.distance < b.distance : a.bookId < b.bookId;
+    });
+    if (result.size() > limit) result.resize(limit);
+    return result;
+}
+
+int LibrarySystem::countAvailableCopies(int bookId) const {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    const CopyGroup* group = findCopyGroup(bookId);
+    return group ? group->getAvailable() : 0;
+}
+
+int LibrarySystem::countTotalCopies(int bookId) const {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    const CopyGroup* group = findCopyGroup(bookId);
+    return group ? group->getTotal() : 0;
+}
+
+bool LibrarySystem::isBookOnLoan(int bookId) const {
+    waitForCatalog();
+    const CopyGroup* group = findCopyGroup(bookId);
+    return group && group->getOnLoan() > 0;
+}
+
+// Trả về id phiếu mượn đang giữ bản sao, hoặc -1 nếu bản sao đang trên kệ.
+int LibrarySystem::findActiveLoanOfCopy(int copyId) const {
+    waitForCatalog();
+    return copyActiveLoan.find(copyId);
+}
+
+const BookItem* LibrarySystem::findAvailableCopy(int bookId) const {
+    waitForCatalog();
+    const CopyGroup* group = findCopyGroup(bookId);
+    if (!group) return nullptr;
+    int copyId = group->firstAvailableCopyId();
+    return copyId < 0 ? nullptr : findCopyById(copyId);
+}
+
+const CopyGroup* LibrarySystem::findCopyGroup(int bookId) const {
+    if (bookTable.find(bookId) < 0) return nullptr;
+    return &copyGroups[bookId];
+}
+
+void LibrarySystem::setCopyAvailable(BookItem& copy, bool value) {
+    copy.setAvailable(value);
+    copyGroups[copy.getBookId()].setAvailable(copy.getId(), value);
+}
+
+Loan* LibrarySystem::borrowBooks(int memberId, const vector<int>& bookItemIds, int today) {
+    ScopedTimer timer(metrics, MetricOp::BorrowBooks);
+    TraceSpan span("borrowBooks");
+    waitForCatalog();
+
+    if (memberTable.find(memberId) < 0) {
+        report(EventCode::MemberNotFound, memberId);
+        return nullptr;
+    }
+
+    MemberLoanState& state = loanStateOf(memberId);
+    if (state.borrowedItems + static_cast<int>(bookItemIds.size()) > maxBorrowedBooks) {
+        report(EventCode::BorrowLimitExceeded, memberId, maxBorrowedBooks);
+        return nullptr;
+    }
+
+    for (int copyId : bookItemIds) {
+        BookItem* copy = findCopyById(copyId);
+        if (!copy || !copy->isAvailable()) {
+            report(EventCode::CopyUnavailable, copyId);
+            return nullptr;
+        }
+    }
+
+    Loan& loan = insertLoan(Loan(nextLoanId, memberId, bookItemIds, today, today + 14), true);
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpBorrow).putInt(loan.getId()).putInt(memberId).putInt(today)
+              .putInt(static_cast<int64_t>(bookItemIds.size()));
+        for (int copyId : bookItemIds) record.putInt(copyId);
+        logMutation(record);
+    }
+
+    report(EventCode::LoanCreated, loan.getId());
+    return &loan;
+}
+
+// Đưa phiếu vào danh sách; phiếu còn mở thì giữ bản sao, ghi vào thành viên và lịch hạn trả.
+Loan& LibrarySystem::insertLoan(const Loan& loan, bool open) {
+    int loanId = loan.getId();
+    nextLoanId = std::max(nextLoanId, loanId + 1);
+    loans.push_back(loan);
+    loanTable.set(loanId, static_cast<int>(loans.size() - 1));
+    if (!open) return loans.back();
+
+    MemberLoanState& state = loanStateOf(loan.getMemberId());
+    state.openLoanIds.push_back(loanId);
+    state.borrowedItems += static_cast<int>(loan.getBookItemIds().size());
+    dueDates.schedule(loanId, loan.getDueDate());
+
+    for (int copyId : loan.getBookItemIds()) {
+        BookItem* copy = findCopyById(copyId);
+        if (copy && copy->isAvailable()) {
+            setCopyAvailable(*copy, false);
+            copyActiveLoan.set(copyId, loanId);
+            copyGroups[copy->getBookId()].addOnLoan(1);
+        }
+    }
+    return loans.back();
+}
+
+bool LibrarySystem::returnLoan(int loanId, int actualReturnDate) {
+    ScopedTimer timer(metrics, MetricOp::ReturnLoan);
+    TraceSpan span("returnLoan");
+    waitForCatalog();
+    Loan* loan = findLoanById(loanId);
+    if (!loan || !isLoanOpen(*loan)) {
+        report(EventCode::LoanNotFound, loanId);
+        return false;
+    }
+    finishReturn(*loan, actualReturnDate);
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpReturn).putInt(loanId).putInt(actualReturnDate);
+        logMutation(record);
+    }
+    report(EventCode::LoanReturned, loanId, 0, loan->getFine());
+    return true;
+}
+
+bool LibrarySystem::renewLoan(int loanId, int extraDays) {
+    ScopedTimer timer(metrics, MetricOp::RenewLoan);
+    TraceSpan span("renewLoan");
+    waitForCatalog();
+    Loan* loan = findLoanById(loanId);
+    if (!loan) {
+        report(EventCode::LoanNotFound, loanId);
+        return false;
+    }
+    if (!loan->canRenew(maxRenewals)) {
+        report(EventCode::RenewalRefused, loanId);
+        return false;
+    }
+    finishRenew(*loan, extraDays);
+    if (journaling()) {
+        JournalRecord record;
+        record.putInt(OpRenew).putInt(loanId).putInt(extraDays);
+        logMutation(record);
+    }
+    report(EventCode::LoanRenewed, loanId, loan->getDueDate());
+    return true;
+}
+
+void LibrarySystem::finishReturn(Loan& loan, int actualReturnDate) {
+    loan.markReturned(actualReturnDate, finePerDay);
+    closeLoan(loan);
+}
+
+void LibrarySystem::finishRenew(Loan& loan, int extraDays) {
+    loan.renew(extraDays);
+    dueDates.schedule(loan.getId(), loan.getDueDate());
+}
+
+const vector<int>& LibrarySystem::getOpenLoanIds(int memberId) const {
+    waitForCatalog();
+    static const vector<int> none;
+    if (memberId <= 0 || static_cast<size_t>(memberId) >= memberLoans.size()) return none;
+    return memberLoans[memberId].openLoanIds;
+}
+
+int LibrarySystem::countBorrowedItems(int memberId) const {
+    waitForCatalog();
+    if (memberId <= 0 || static_cast<size_t>(memberId) >= memberLoans.size()) return 0;
+    return memberLoans[memberId].borrowedItems;
+}
+
+MemberLoanState& LibrarySystem::loanStateOf(int memberId) {
+    if (static_cast<size_t>(memberId) >= memberLoans.size()) {
+        memberLoans.resize(static_cast<size_t>(memberId) + 1);
+    }
+    return memberLoans[memberId];
+}
+
+// Trả bản sao về kệ và gỡ phiếu khỏi danh sách đang mượn của thành viên.
+void LibrarySystem::closeLoan(const Loan& loan) {
+    for (int copyId : loan.getBookItemIds()) {
+        if (copyActiveLoan.find(copyId) != loan.getId()) continue;
+        copyActiveLoan.erase(copyId);
+        BookItem* copy = findCopyById(copyId);
+        if (copy) {
+            setCopyAvailable(*copy, true);
+            copyGroups[copy->getBookId()].addOnLoan(-1);
+        }
+    }
+    MemberLoanState& state = loanStateOf(loan.getMemberId());
+    auto it = std::find(state.openLoanIds.begin(), state.openLoanIds.end(), loan.getId());
+    if (it != state.openLoanIds.end()) {
+        state.openLoanIds.erase(it);
+        state.borrowedItems -= static_cast<int>(loan.getBookItemIds().size());
+    }
+}
+
+bool LibrarySystem::isLoanOpen(const Loan& loan) const {
+    const vector<int>& open = getOpenLoanIds(loan.getMemberId());
+    return std::find(open.begin(), open.end(), loan.getId()) != open.end();
+}
+
+void DueDateScheduler::schedule(int loanId, int dueDate) {
+    events.push(DueEvent{ dueDate - kReminderDays, loanId, dueDate, DueEventKind::Reminder });
+    events.push(DueEvent{ dueDate + 1, loanId, dueDate, DueEventKind::Overdue });
+}
+
+void DueDateScheduler::scheduleOverdue(int loanId, int dueDate, int day) {
+    events.push(DueEvent{ day, loanId, dueDate, DueEventKind::Overdue });
+}
+
+// Chỉ lấy các mốc đã tới hạn trong heap nên chi phí tỉ lệ với số phiếu đổi trạng thái
+// hoặc đang quá hạn, không phải tổng số phiếu. Phiếu quá hạn được xếp lại cho ngày hôm
+// sau nên tiền phạt tăng theo từng lượt quét và thành viên được nhắc mỗi ngày cho tới
+// khi trả/gia hạn; tiền phạt được chốt lại khi trả sách (markReturned).
+// Thông báo được đẩy vào hàng đợi, luồng nền gửi theo kênh thành viên đã chọn.
+void LibrarySystem::updateOverdueAndSendReminders(int today) {
+    TraceSpan span("updateOverdueAndSendReminders");
+    waitForCatalog();
+    size_t queued = 0;
+    dueDates.advanceTo(today, [&](const DueEvent& event) {
+        Loan* loan = findLoanById(event.loanId);
+        if (!loan || loan->getDueDate() != event.dueDate || !isLoanOpen(*loan)) return;
+        int daysToDue = loan->getDueDate() - today;
+        string message;
+        if (event.kind == DueEventKind::Reminder) {
+            if (daysToDue < 0) return;
+            message = "Nhac nho: Phieu muon #" + std::to_string(loan->getId())
+                    + " sap den han (con " + std::to_string(daysToDue) + " ngay).";
+        } else {
+            loan->markOverdue(finePerDay, today);
+            dueDates.scheduleOverdue(loan->getId(), loan->getDueDate(), today + 1);
+            std::ostringstream fine;
+            fine << loan->getFine();
+            message = "Qua han: Phieu muon #" + std::to_string(loan->getId())
+                    + " da qua han " + std::to_string(-daysToDue) + " ngay. Tien phat: " + fine.str();
+        }
+
+        MemberAccount* m = findMemberById(loan->getMemberId());
+        if (!m) return;
+        Notification notification;
+        notification.memberId = m->getId();
+        notification.loanId = loan->getId();
+        notification.kind = event.kind;
+        notification.channel = m->getPreference();
+        notification.recipientName = m->getName();
+        notification.recipientAddress = notification.channel == NotificationPreference::Email
+            ? m->getEmail() : m->getAddress();
+        notification.message = std::move(message);
+        notifier.enqueue(std::move(notification));
+        ++queued;
+    });
+    report(EventCode::NotificationsQueued, 0, static_cast<int>(queued));
+}
+
+void LibrarySystem::setNotificationSink(NotificationPreference channel, std::unique_ptr<NotificationSink> sink) {
+    notifier.setSink(channel, std::move(sink));
+}
+
+void LibrarySystem::flushNotifications() {
+    notifier.flush();
+}
+
+void MailSpoolSink::deliver(const vector<Notification>& batch) {
+    std::ofstream out(path, std::ios::app);
+    for (const auto& n : batch) {
+        out << "To: " << n.recipientName << " <" << n.recipientAddress << ">\n"
+            << "Subject: Thong bao thu vien - phieu muon #" << n.loanId << "\n\n"
+            << n.message << "\n.\n";
+    }
+}
+
+void PostalBatchSink::deliver(const vector<Notification>& batch) {
+    std::ofstream out(path, std::ios::app);
+    for (const auto& n : batch) {
+        out << n.recipientName << "|" << n.recipientAddress << "|" << n.message << "\n";
+    }
+}
+
+NotificationDispatcher::NotificationDispatcher(size_t capacity, size_t batchSize)
+    : capacity(std::max<size_t>(capacity, 1)),
+      batchSize(std::max<size_t>(batchSize, 1)),
+      emailSink(std::make_unique<MailSpoolSink>("mail_spool.txt")),
+      postalSink(std::make_unique<PostalBatchSink>("postal_batch.txt")) {
+}
+
+NotificationDispatcher::~NotificationDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    hasWork.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+void NotificationDispatcher::setSink(NotificationPreference channel, std::unique_ptr<NotificationSink> sink) {
+    flush();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (channel == NotificationPreference::Email) emailSink = std::move(sink);
+    else postalSink = std::move(sink);
+}
+
+void NotificationDispatcher::enqueue(Notification notification) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!worker.joinable()) worker = std::thread([this] { workerLoop(); });
+    hasRoom.wait(lock, [this] { return queue.size() < capacity; });
+    queue.push_back(std::move(notification));
+    lock.unlock();
+    hasWork.notify_one();
+}
+
+void NotificationDispatcher::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return queue.empty() && inFlight == 0; });
+}
+
+void NotificationDispatcher::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        hasWork.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        vector<Notification> emails;
+        vector<Notification> letters;
+        while (!queue.empty() && emails.size() + letters.size() < batchSize) {
+            Notification& n = queue.front();
+            (n.channel == NotificationPreference::Email ? emails : letters).push_back(std::move(n));
+            queue.pop_front();
+        }
+        inFlight = emails.size() + letters.size();
+        NotificationSink* mail = emailSink.get();
+        NotificationSink* post = postalSink.get();
+        lock.unlock();
+        hasRoom.notify_all();
+
+        if (mail && !emails.empty()) mail->deliver(emails);
+        if (post && !letters.empty()) post->deliver(letters);
+
+        lock.lock();
+        inFlight = 0;
+        if (queue.empty()) drained.notify_all();
+    }
+}
+
+bool LibraryEvent::isError() const {
+    switch (code) {
+    case EventCode::MemberRegistered:
+    case EventCode::PasswordResetSent:
+    case EventCode::PasswordChanged:
+    case EventCode::LoanCreated:
+    case EventCode::LoanReturned:
+    case EventCode::LoanRenewed:
+    case EventCode::NotificationsQueued:
+        return false;
+    default:
+        return true;
+    }
+}
+
+string describeEvent(const LibraryEvent& event) {
+    std::ostringstream out;
+    switch (event.code) {
+    case EventCode::MemberRegistered:
+        out << "Dang ky thanh cong. So the thu vien: " << event.text;
+        break;
+    case EventCode::EmailAlreadyExists:
+        out << "Email da ton tai trong he thong.";
+        break;
+    case EventCode::PasswordTooShort:
+        out << "Mat khau phai co it nhat " << event.value << " ky tu.";
+        break;
+    case EventCode::MemberHasOpenLoans:
+        out << "Thanh vien con phieu muon chua tra, khong the xoa.";
+        break;
+    case EventCode::EmailNotRegistered:
+        out << "This email is not registered in the system.";
+        break;
+    case EventCode::PasswordResetSent:
+        out << "Gui ma xac thuc / lien ket reset password toi " << event.text << "...";
+        break;
+    case EventCode::PasswordChanged:
+        out << "Mat khau da duoc cap nhat.";
+        break;
+    case EventCode::BookOnLoan:
+        out << "Khong the xoa sach dang duoc muon.";
+        break;
+    case EventCode::MemberNotFound:
+        out << "Khong tim thay thanh vien #" << event.id << ".";
+        break;
+    case EventCode::BorrowLimitExceeded:
+        out << "Vuot qua gioi han muon sach (" << event.value << ").";
+        break;
+    case EventCode::CopyUnavailable:
+        out << "Ban sao sach co ID " << event.id << " khong san sang de muon.";
+        break;
+    case EventCode::LoanCreated:
+        out << "Tao phieu muon #" << event.id << " thanh cong.";
+        break;
+    case EventCode::LoanNotFound:
+        out << "Khong tim thay phieu muon hop le #" << event.id << ".";
+        break;
+    case EventCode::LoanReturned:
+        out << "Cap nhat tra sach cho phieu muon #" << event.id << ". Tien phat: " << event.amount;
+        break;
+    case EventCode::RenewalRefused:
+        out << "Khong the gia han phieu muon #" << event.id
+            << " (vuot qua so lan cho phep hoac khong con hieu luc).";
+        break;
+    case EventCode::LoanRenewed:
+        out << "Da gia han phieu muon #" << event.id << " den ngay " << event.value;
+        break;
+    case EventCode::NotificationsQueued:
+        out << "=== Notifications & Reminders ===\nDa xep hang " << event.value << " thong bao.";
+        break;
+    case EventCode::JournalTailTruncated:
+        out << "Journal " << event.text << " bi hong o cuoi, da cat bo phan khong hop le.";
+        break;
+    case EventCode::JournalOpenFailed:
+        out << "Khong the mo journal " << event.text << ".";
+        break;
+    case EventCode::JournalWriteFailed:
+        out << "Loi ghi journal " << event.text << ".";
+        break;
+    case EventCode::SnapshotReadFailed:
+        out << "Khong doc duoc snapshot " << event.text << ".";
+        break;
+    case EventCode::SnapshotWriteFailed:
+        out << "Khong the ghi snapshot " << event.text << ".";
+        break;
+    case EventCode::SnapshotDamaged:
+        out << "Snapshot " << event.text << " co ban ghi hong, da bo qua.";
+        break;
+    }
+    return out.str();
+}
+
+ConsoleEventSink::~ConsoleEventSink() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    hasWork.notify_all();
+    if (worker.joinable()) worker.join();
+}
+
+void ConsoleEventSink::publish(const LibraryEvent& event) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(event);
+        if (!worker.joinable()) worker = std::thread(&ConsoleEventSink::workerLoop, this);
+    }
+    hasWork.notify_one();
+}
+
+void ConsoleEventSink::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return queue.empty() && !writing; });
+}
+
+// Định dạng cả lô ngoài khoá rồi ghi ra cout một lần.
+void ConsoleEventSink::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        hasWork.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        std::deque<LibraryEvent> batch;
+        batch.swap(queue);
+        writing = true;
+        lock.unlock();
+
+        string text;
+        for (const auto& event : batch) {
+            text += describeEvent(event);
+            text += '\n';
+        }
+        cout << text << std::flush;
+
+        lock.lock();
+        writing = false;
+        if (queue.empty()) drained.notify_all();
+    }
+}
+
+const char* metricOpName(MetricOp op) {
+    switch (op) {
+    case MetricOp::Login: return "login";
+    case MetricOp::RegisterMember: return "register_member";
+    case MetricOp::SearchBooks: return "search_books";
+    case MetricOp::SearchBooksPage: return "search_books_page";
+    case MetricOp::SearchFacets: return "search_facets";
+    case MetricOp::Autocomplete: return "autocomplete";
+    case MetricOp::FuzzySearch: return "fuzzy_search";
+    case MetricOp::BorrowBooks: return "borrow_books";
+    case MetricOp::ReturnLoan: return "return_loan";
+    case MetricOp::RenewLoan: return "renew_loan";
+    case MetricOp::ImportBooks: return "import_books";
+    case MetricOp::ImportMembers: return "import_members";
+    case MetricOp::LoadSnapshot: return "load_snapshot";
+    case MetricOp::OpenJournal: return "open_journal";
+    case MetricOp::Checkpoint: return "checkpoint";
+    }
+    return "unknown";
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < kSubBuckets) return static_cast<size_t>(value);
+    int highest = 0;
+    for (int step = 32; step > 0; step /= 2) {
+        if (value >> (highest + step)) highest += step;
+    }
+    int shift = highest - kSubBucketBits;
+    return static_cast<size_t>(shift + 1) * kSubBuckets + static_cast<size_t>((value >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::bucketLowerBound(size_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    size_t shift = bucket / kSubBuckets - 1;
+    return static_cast<uint64_t>(bucket % kSubBuckets + kSubBuckets) << shift;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    size_t shift = bucket / kSubBuckets - 1;
+    return bucketLowerBound(bucket) + ((uint64_t(1) << shift) - 1);
+}
+
+uint64_t OperationStats::percentile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count));
+    if (rank >= count) rank = count - 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen > rank) return std::min(LatencyHistogram::bucketUpperBound(i), maxNanos);
+    }
+    return maxNanos;
+}
+
+namespace {
+    std::atomic<uint64_t> nextMetricsInstance{ 1 };
+}
+
+Metrics::Metrics() : instanceId(nextMetricsInstance.fetch_add(1)) {
+}
+
+// Cache một mục theo luồng (id đối tượng -> shard); trượt thì tìm/tạo shard dưới khoá.
+// Dùng id thay cho địa chỉ để đối tượng mới cùng địa chỉ không trúng cache cũ.
+Metrics::Shard& Metrics::localShard() {
+    thread_local uint64_t cachedInstance = 0;
+    thread_local Shard* cachedShard = nullptr;
+    if (cachedInstance == instanceId) return *cachedShard;
+
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    std::thread::id self = std::this_thread::get_id();
+    Shard* shard = nullptr;
+    for (const auto& candidate : shards) {
+        if (candidate->owner == self) shard = candidate.get();
+    }
+    if (!shard) {
+        shards.push_back(std::make_unique<Shard>());
+        shard = shards.back().get();
+        shard->owner = self;
+    }
+    cachedInstance = instanceId;
+    cachedShard = shard;
+    return *shard;
+}
+
+void Metrics::record(MetricOp op, uint64_t nanos) {
+    OpShard& slot = localShard().ops[static_cast<size_t>(op)];
+    slot.count.fetch_add(1, std::memory_order_relaxed);
+    slot.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    slot.buckets[LatencyHistogram::bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    if (nanos > slot.maxNanos.load(std::memory_order_relaxed)) {
+        slot.maxNanos.store(nanos, std::memory_order_relaxed);
+    }
+}
+
+vector<OperationStats> Metrics::snapshot() {
+    vector<OperationStats> result(kMetricOpCount);
+    for (size_t op = 0; op < kMetricOpCount; ++op) {
+        result[op].op = static_cast<MetricOp>(op);
+        result[op].buckets.assign(LatencyHistogram::kBucketCount, 0);
+    }
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    for (const auto& shard : shards) {
+        for (size_t op = 0; op < kMetricOpCount; ++op) {
+            const OpShard& slot = shard->ops[op];
+            OperationStats& stats = result[op];
+            stats.count += slot.count.load(std::memory_order_relaxed);
+            stats.totalNanos += slot.totalNanos.load(std::memory_order_relaxed);
+            stats.maxNanos = std::max(stats.maxNanos, slot.maxNanos.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < LatencyHistogram::kBucketCount; ++b) {
+                stats.buckets[b] += slot.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return result;
+}
+
+bool LibrarySystem::writeMetrics(const string& path) const {
+    std::ostringstream out;
+    out << "{\n  \"operations\": [";
+    bool first = true;
+    for (const auto& stats : metrics.snapshot()) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\"name\": \"" << metricOpName(stats.op) << "\", \"count\": " << stats.count
+            << ", \"total_ns\": " << stats.totalNanos << ", \"max_ns\": " << stats.maxNanos
+            << ", \"p50_ns\": " << stats.percentile(0.50) << ", \"p90_ns\": " << stats.percentile(0.90)
+            << ", \"p99_ns\": " << stats.percentile(0.99) << ", \"p999_ns\": " << stats.percentile(0.999)
+            << ", \"buckets\": [";
+        bool firstBucket = true;
+        for (size_t b = 0; b < stats.buckets.size(); ++b) {
+            if (stats.buckets[b] == 0) continue;
+            out << (firstBucket ? "" : ", ") << "[" << LatencyHistogram::bucketUpperBound(b) << ", " << stats.buckets[b] << "]";
+            firstBucket = false;
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+    return Journal::writeFileDurably(path, out.str());
+}
+
+namespace {
+    // Một ô của vòng đệm, ghi kiểu seqlock: sequence lẻ khi đang ghi, bằng 2*(chỉ số+1)
+    // khi xong. Người đọc bỏ qua ô đang bị ghi đè.
+    struct TraceSlot {
+        std::atomic<uint64_t> sequence{ 0 };
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<const char*> category{ nullptr };
+        std::atomic<uint64_t> startNanos{ 0 };
+        std::atomic<uint64_t> endNanos{ 0 };
+    };
+
+    struct TraceRing {
+        uint32_t threadNumber{};
+        std::atomic<uint64_t> written{ 0 };
+        TraceSlot slots[Tracer::kTraceRingCapacity];
+    };
+
+    // Vòng đệm không bao giờ được giải phóng nên luồng đã kết thúc vẫn xuất được span.
+    struct TraceRegistry {
+        std::mutex mutex;
+        vector<std::unique_ptr<TraceRing>> rings;
+        std::atomic<bool> enabled{ true };
+        std::chrono::steady_clock::time_point epoch{ std::chrono::steady_clock::now() };
+    };
+
+    TraceRegistry& traceRegistry() {
+        static TraceRegistry* registry = new TraceRegistry();
+        return *registry;
+    }
+
+    TraceRing& localTraceRing() {
+        thread_local TraceRing* ring = [] {
+            TraceRegistry& registry = traceRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.rings.push_back(std::make_unique<TraceRing>());
+            registry.rings.back()->threadNumber = static_cast<uint32_t>(registry.rings.size());
+            return registry.rings.back().get();
+        }();
+        return *ring;
+    }
+
+    void writeJsonString(std::ostringstream& out, const char* text) {
+        out << '"';
+        for (const char* p = text; *p; ++p) {
+            if (*p == '"' || *p == '\\') out << '\\';
+            out << *p;
+        }
+        out << '"';
+    }
+}
+
+void Tracer::setEnabled(bool enabled) {
+    traceRegistry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Tracer::enabled() {
+    return traceRegistry().enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Tracer::now() {
+    auto elapsed = std::chrono::steady_clock::now() - traceRegistry().epoch;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) + 1;
+}
+
+void Tracer::record(const char* name, const char* category, uint64_t startNanos, uint64_t endNanos) {
+    TraceRing& ring = localTraceRing();
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    TraceSlot& slot = ring.slots[index % kTraceRingCapacity];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.startNanos.store(startNanos, std::memory_order_relaxed);
+    slot.endNanos.store(endNanos, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+// Sự kiện "X" (complete) với ts/dur theo micro giây; mỗi vòng đệm là một tid.
+bool Tracer::writeChromeTrace(const string& path) {
+    TraceRegistry& registry = traceRegistry();
+    vector<TraceRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const auto& ring : registry.rings) rings.push_back(ring.get());
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (TraceRing* ring : rings) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->threadNumber
+            << ", \"args\": {\"name\": \"thread " << ring->threadNumber << "\"}}";
+
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t begin = written > kTraceRingCapacity ? written - kTraceRingCapacity : 0;
+        for (uint64_t index = begin; index < written; ++index) {
+            const TraceSlot& slot = ring->slots[index % kTraceRingCapacity];
+            uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            const char* name = slot.name.load(std::memory_order_relaxed);
+            const char* category = slot.category.load(std::memory_order_relaxed);
+            uint64_t start = slot.startNanos.load(std::memory_order_relaxed);
+            uint64_t end = slot.endNanos.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before != 2 * index + 2 || slot.sequence.load(std::memory_order_relaxed) != before) continue;
+
+            out << ",\n{\"name\": ";
+            writeJsonString(out, name);
+            out << ", \"cat\": ";
+            writeJsonString(out, category);
+            out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->threadNumber
+                << ", \"ts\": " << static_cast<double>(start) / 1000.0
+                << ", \"dur\": " << static_cast<double>(end - start) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return Journal::writeFileDurably(path, out.str());
+}
+
+namespace {
+    // Chuỗi ngắn nằm ngay trong đối tượng (SSO); dài hơn thì cấp phát capacity + 1 byte.
+    size_t stringHeapBytes(const string& text) {
+        static const size_t inlineCapacity = string().capacity();
+        return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+    }
+
+    template <typename T>
+    size_t vectorHeapBytes(const vector<T>& items) {
+        return items.capacity() * sizeof(T);
+    }
+
+    // Nút unordered_map: con trỏ next + giá trị + hash lưu sẵn; cộng mảng bucket.
+    template <typename Map>
+    size_t hashTableBytes(const Map& map) {
+        return map.bucket_count() * sizeof(void*)
+            + map.size() * (sizeof(void*) + sizeof(typename Map::value_type) + sizeof(size_t));
+    }
+
+    // Nút cây đỏ-đen: màu + 3 con trỏ, rồi tới giá trị.
+    template <typename Map>
+    size_t treeNodeBytes(const Map& map) {
+        return map.size() * (4 * sizeof(void*) + sizeof(typename Map::value_type));
+    }
+
+    template <typename T>
+    ContainerMemory vectorMemory(const char* name, const vector<T>& items) {
+        ContainerMemory usage;
+        usage.name = name;
+        usage.count = items.size();
+        usage.capacity = items.capacity();
+        usage.inlineBytes = vectorHeapBytes(items);
+        return usage;
+    }
+
+    ContainerMemory named(const char* name, ContainerMemory usage) {
+        usage.name = name;
+        return usage;
+    }
+}
+
+ContainerMemory IdTable::memoryUsage() const {
+    ContainerMemory usage = vectorMemory("", slots);
+    usage.count = static_cast<size_t>(std::count_if(slots.begin(), slots.end(), [](int p) { return p >= 0; }));
+    return usage;
+}
+
+ContainerMemory TextArena::memoryUsage() const {
+    ContainerMemory usage = vectorMemory("", records);
+    usage.count = liveRecords;
+    usage.inlineBytes += vectorHeapBytes(recordOfBook);
+    usage.stringBytes = stringHeapBytes(bytes);
+    return usage;
+}
+
+ContainerMemory TrigramIndex::memoryUsage() const {
+    ContainerMemory usage;
+    usage.count = postings.size();
+    usage.capacity = postings.bucket_count();
+    usage.inlineBytes = hashTableBytes(postings);
+    for (const auto& entry : postings) usage.otherHeapBytes += vectorHeapBytes(entry.second);
+    return usage;
+}
+
+size_t RoaringBitmap::heapBytes() const {
+    size_t bytes = vectorHeapBytes(containers);
+    for (const auto& c : containers) bytes += vectorHeapBytes(c.array) + vectorHeapBytes(c.bits);
+    return bytes;
+}
+
+ContainerMemory FacetIndex::memoryUsage() const {
+    ContainerMemory usage;
+    usage.count = subjects.size() + years.size() + authorTokens.size();
+    usage.capacity = usage.count;
+    usage.inlineBytes = treeNodeBytes(subjects) + treeNodeBytes(years) + treeNodeBytes(authorTokens);
+    for (const auto& entry : subjects) {
+        usage.stringBytes += stringHeapBytes(entry.first);
+        usage.otherHeapBytes += entry.second.heapBytes();
+    }
+    for (const auto& entry : years) usage.otherHeapBytes += entry.second.heapBytes();
+    for (const auto& entry : authorTokens) {
+        usage.stringBytes += stringHeapBytes(entry.first);
+        usage.otherHeapBytes += entry.second.heapBytes();
+    }
+    return usage;
+}
+
+ContainerMemory QueryCache::memoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ContainerMemory usage;
+    usage.count = recent.size();
+    usage.capacity = capacity;
+    // Nút list (2 con trỏ + Entry) và bảng băm trỏ vào list; khoá nằm ở cả hai nơi.
+    usage.inlineBytes = recent.size() * (2 * sizeof(void*) + sizeof(Entry)) + hashTableBytes(entries);
+    for (const auto& entry : recent) {
+        usage.stringBytes += 2 * stringHeapBytes(entry.key);
+        usage.otherHeapBytes += vectorHeapBytes(entry.bookIds);
+    }
+    return usage;
+}
+
+ContainerMemory PrefixIndex::memoryUsage() const {
+    ContainerMemory usage;
+    usage.count = terms.size();
+    usage.capacity = terms.size();
+    usage.inlineBytes = treeNodeBytes(terms);
+    for (const auto& entry : terms) {
+        usage.stringBytes += stringHeapBytes(entry.first);
+        usage.otherHeapBytes += vectorHeapBytes(entry.second);
+    }
+    return usage;
+}
+
+ContainerMemory FuzzyIndex::memoryUsage() const {
+    ContainerMemory usage = vectorMemory("", termTexts);
+    usage.inlineBytes += vectorHeapBytes(termPostings) + vectorHeapBytes(tree) + hashTableBytes(termIds);
+    for (const auto& term : termTexts) usage.stringBytes += stringHeapBytes(term);
+    for (const auto& entry : termIds) usage.stringBytes += stringHeapBytes(entry.first);
+    for (const auto& postings : termPostings) usage.otherHeapBytes += vectorHeapBytes(postings);
+    for (const auto& node : tree) usage.otherHeapBytes += vectorHeapBytes(node.children);
+    return usage;
+}
+
+vector<ContainerMemory> LibrarySystem::memoryUsage() const {
+    waitForCatalog();
+    vector<ContainerMemory> report;
+
+    // deque cấp phát theo khối, mỗi khối ít nhất một phần tử; bỏ qua mảng con trỏ khối.
+    ContainerMemory memberUsage;
+    memberUsage.name = "members";
+    memberUsage.count = members.size();
+    memberUsage.capacity = members.size();
+    memberUsage.inlineBytes = members.size() * sizeof(MemberAccount);
+    for (const auto& m : members) {
+        memberUsage.stringBytes += stringHeapBytes(m.getName()) + stringHeapBytes(m.getDateOfBirth())
+            + stringHeapBytes(m.getAddress()) + stringHeapBytes(m.getPhone())
+            + stringHeapBytes(m.getEmail()) + stringHeapBytes(m.getPasswordHash())
+            + stringHeapBytes(m.getCard().cardNumber) + stringHeapBytes(m.getCard().issuedDate);
+    }
+    report.push_back(memberUsage);
+
+    ContainerMemory bookUsage = vectorMemory("books", books);
+    for (const auto& b : books) {
+        bookUsage.stringBytes += stringHeapBytes(b.getIsbn()) + stringHeapBytes(b.getTitle())
+            + stringHeapBytes(b.getAuthor()) + stringHeapBytes(b.getSubject())
+            + stringHeapBytes(b.getLanguage()) + stringHeapBytes(b.getRackPosition())
+            + stringHeapBytes(b.getDescription());
+    }
+    report.push_back(bookUsage);
+
+    ContainerMemory copyUsage = vectorMemory("copies", copies);
+    for (const auto& c : copies) {
+        copyUsage.stringBytes += stringHeapBytes(c.getBarcode()) + stringHeapBytes(c.getLocation());
+    }
+    report.push_back(copyUsage);
+
+    ContainerMemory loanUsage = vectorMemory("loans", loans);
+    for (const auto& l : loans) loanUsage.otherHeapBytes += vectorHeapBytes(l.getBookItemIds());
+    report.push_back(loanUsage);
+
+    report.push_back(vectorMemory("reservations", reservations));
+
+    ContainerMemory memberLoanUsage = vectorMemory("memberLoans", memberLoans);
+    for (const auto& state : memberLoans) memberLoanUsage.otherHeapBytes += vectorHeapBytes(state.openLoanIds);
+    report.push_back(memberLoanUsage);
+
+    ContainerMemory groupUsage = vectorMemory("copyGroups", copyGroups);
+    for (const auto& group : copyGroups) groupUsage.otherHeapBytes += group.heapBytes();
+    report.push_back(groupUsage);
+
+    report.push_back(named("memberTable", memberTable.memoryUsage()));
+    report.push_back(named("bookTable", bookTable.memoryUsage()));
+    report.push_back(named("copyTable", copyTable.memoryUsage()));
+    report.push_back(named("copyActiveLoan", copyActiveLoan.memoryUsage()));
+    report.push_back(named("loanTable", loanTable.memoryUsage()));
+
+    // Khoá là string_view trỏ vào email của thành viên nên không có chuỗi riêng.
+    ContainerMemory emailUsage;
+    emailUsage.name = "emailIndex";
+    emailUsage.count = emailIndex.size();
+    emailUsage.capacity = emailIndex.bucket_count();
+    emailUsage.inlineBytes = hashTableBytes(emailIndex);
+    report.push_back(emailUsage);
+
+    ContainerMemory isbnUsage;
+    isbnUsage.name = "isbnIndex";
+    isbnUsage.count = isbnIndex.size();
+    isbnUsage.capacity = isbnIndex.bucket_count();
+    isbnUsage.inlineBytes = hashTableBytes(isbnIndex);
+    for (const auto& entry : isbnIndex) isbnUsage.stringBytes += stringHeapBytes(entry.first);
+    report.push_back(isbnUsage);
+
+    ContainerMemory barcodeUsage;
+    barcodeUsage.name = "barcodeIndex";
+    barcodeUsage.count = barcodeIndex.size();
+    barcodeUsage.capacity = barcodeIndex.bucket_count();
+    barcodeUsage.inlineBytes = hashTableBytes(barcodeIndex);
+    for (const auto& entry : barcodeIndex) barcodeUsage.stringBytes += stringHeapBytes(entry.first);
+    report.push_back(barcodeUsage);
+
+    {
+        std::lock_guard<std::mutex> lock(searchIndexMutex);
+        report.push_back(named("keywordIndex", keywordIndex.memoryUsage()));
+        report.push_back(named("keywordText", keywordIndex.textMemoryUsage()));
+        report.push_back(named("facetIndex", facetIndex.memoryUsage()));
+        report.push_back(named("prefixIndex", prefixIndex.memoryUsage()));
+        report.push_back(named("fuzzyIndex", fuzzyIndex.memoryUsage()));
+    }
+
+    ContainerMemory dueUsage;
+    dueUsage.name = "dueDates";
+    dueUsage.count = dueDates.pending();
+    dueUsage.capacity = dueDates.pending();
+    dueUsage.inlineBytes = dueDates.pending() * sizeof(DueEvent);
+    report.push_back(dueUsage);
+
+    report.push_back(named("queryCache", queryCache.memoryUsage()));
+    return report;
+}
+
+bool LibrarySystem::writeMemoryReport(const string& path) const {
+    vector<ContainerMemory> report = memoryUsage();
+    size_t total = 0;
+    std::ostringstream out;
+    out << "{\n  \"containers\": [";
+    bool first = true;
+    for (const auto& usage : report) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\"name\": \"" << usage.name << "\", \"count\": " << usage.count
+            << ", \"capacity\": " << usage.capacity << ", \"inline_bytes\": " << usage.inlineBytes
+            << ", \"string_bytes\": " << usage.stringBytes << ", \"other_heap_bytes\": " << usage.otherHeapBytes
+            << ", \"total_bytes\": " << usage.totalBytes() << "}";
+        total += usage.totalBytes();
+    }
+    out << "\n  ],\n  \"total_bytes\": " << total << "\n}\n";
+    return Journal::writeFileDurably(path, out.str());
+}
+
+void LibrarySystem::report(EventCode code, int id, int value, double amount, const string& text) {
+    events->publish(LibraryEvent{ code, id, value, amount, text });
+}
+
+void LibrarySystem::setEventSink(std::unique_ptr<EventSink> sink) {
+    events->flush();
+    events = sink ? std::move(sink) : std::make_unique<NullEventSink>();
+}
+
+void LibrarySystem::flushEvents() {
+    events->flush();
+}
+
+Book* LibrarySystem::findBookById(int bookId) {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = bookTable.find(bookId);
+    return position < 0 ? nullptr : &books[position];
+}
+
+const Book* LibrarySystem::findBookById(int bookId) const {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = bookTable.find(bookId);
+    return position < 0 ? nullptr : &books[position];
+}
+
+BookItem* LibrarySystem::findCopyById(int copyId) {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = copyTable.find(copyId);
+    return position < 0 ? nullptr : &copies[position];
+}
+
+const BookItem* LibrarySystem::findCopyById(int copyId) const {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = copyTable.find(copyId);
+    return position < 0 ? nullptr : &copies[position];
+}
+
+// ISBN có thể trùng giữa các đầu sách; trả về đầu sách có id nhỏ nhất,
+// giống thứ tự duyệt vector books trước đây.
+const Book* LibrarySystem::findBookByIsbn(const string& isbn) const {
+    waitForCatalog();
+    auto range = isbnIndex.equal_range(isbn);
+    int bestId = -1;
+    for (auto it = range.first; it != range.second; ++it) {
+        if (bestId < 0 || it->second < bestId) bestId = it->second;
+    }
+    return bestId < 0 ? nullptr : findBookById(bestId);
+}
+
+BookItem* LibrarySystem::findCopyByBarcode(const string& barcode) {
+    waitForCatalog();
+    auto it = barcodeIndex.find(barcode);
+    return it == barcodeIndex.end() ? nullptr : findCopyById(it->second);
+}
+
+const BookItem* LibrarySystem::findCopyByBarcode(const string& barcode) const {
+    waitForCatalog();
+    auto it = barcodeIndex.find(barcode);
+    return it == barcodeIndex.end() ? nullptr : findCopyById(it->second);
+}
+
+Loan* LibrarySystem::findLoanById(int loanId) {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = loanTable.find(loanId);
+    return position < 0 ? nullptr : &loans[position];
+}
+
+const Loan* LibrarySystem::findLoanById(int loanId) const {
+    CatalogReadLock lock(catalogMutex, isCatalogLoading());
+    int position = loanTable.find(loanId);
+    return position < 0 ? nullptr : &loans[position];
+}
+
+
+namespace {
+    uint32_t crc32(const char* data, size_t size) {
+        static const vector<uint32_t> table = [] {
+            vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i) {
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    const size_t kFrameHeader = 16;
+
+#ifdef _WIN32
+    int openFile(const string& path, bool truncateExisting) {
+        return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY | (truncateExisting ? _O_TRUNC : _O_APPEND),
+                     _S_IREAD | _S_IWRITE);
+    }
+    long long writeSome(int fd, const char* data, size_t size) { return _write(fd, data, static_cast<unsigned>(size)); }
+    void syncFile(int fd) { _commit(fd); }
+    void closeFile(int fd) { _close(fd); }
+    long long fileSize(int fd) { return _lseeki64(fd, 0, SEEK_END); }
+    bool truncateFile(int fd, long long size) { return _chsize_s(fd, size) == 0; }
+#else
+    int openFile(const string& path, bool truncateExisting) {
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | (truncateExisting ? O_TRUNC : O_APPEND), 0644);
+    }
+    long long writeSome(int fd, const char* data, size_t size) { return ::write(fd, data, size); }
+    void syncFile(int fd) { ::fsync(fd); }
+    void closeFile(int fd) { ::close(fd); }
+    long long fileSize(int fd) { return ::lseek(fd, 0, SEEK_END); }
+    bool truncateFile(int fd, long long size) { return ::ftruncate(fd, size) == 0; }
+#endif
+
+    bool writeAll(int fd, const string& bytes) {
+        size_t written = 0;
+        while (written < bytes.size()) {
+            long long n = writeSome(fd, bytes.data() + written, bytes.size() - written);
+            if (n <= 0) return false;
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+JournalRecord& JournalRecord::putInt(int64_t value) {
+    char raw[sizeof(value)];
+    std::memcpy(raw, &value, sizeof(value));
+    bytes.append(raw, sizeof(raw));
+    return *this;
+}
+
+JournalRecord& JournalRecord::putDouble(double value) {
+    int64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return putInt(bits);
+}
+
+JournalRecord& JournalRecord::putString(const string& value) {
+    putInt(static_cast<int64_t>(value.size()));
+    bytes += value;
+    return *this;
+}
+
+int64_t JournalRecord::readInt() {
+    int64_t value = 0;
+    if (readFailed || bytes.size() - readPosition < sizeof(value)) {
+        readFailed = true;
+        return 0;
+    }
+    std::memcpy(&value, bytes.data() + readPosition, sizeof(value));
+    readPosition += sizeof(value);
+    return value;
+}
+
+double JournalRecord::readDouble() {
+    int64_t bits = readInt();
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+string JournalRecord::readString() {
+    int64_t size = readInt();
+    if (readFailed || size < 0 || bytes.size() - readPosition < static_cast<uint64_t>(size)) {
+        readFailed = true;
+        return string();
+    }
+    string value = bytes.substr(readPosition, static_cast<size_t>(size));
+    readPosition += static_cast<size_t>(size);
+    return value;
+}
+
+Journal::~Journal() {
+    close();
+}
+
+string Journal::frame(uint64_t lsn, const string& payload) {
+    string out(kFrameHeader, '\0');
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    std::memcpy(&out[0], &size, sizeof(size));
+    std::memcpy(&out[8], &lsn, sizeof(lsn));
+    out += payload;
+    uint32_t crc = crc32(out.data() + 8, out.size() - 8);
+    std::memcpy(&out[4], &crc, sizeof(crc));
+    return out;
+}
+
+long long Journal::readAll(const string& path,
+                           const std::function<void(uint64_t, JournalRecord&)>& fn) {
+    TraceSpan span("journal.readAll", "io");
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return -1;
+    string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    size_t position = 0;
+    while (data.size() - position >= kFrameHeader) {
+        uint32_t size, crc;
+        uint64_t lsn;
+        std::memcpy(&size, data.data() + position, sizeof(size));
+        std::memcpy(&crc, data.data() + position + 4, sizeof(crc));
+        std::memcpy(&lsn, data.data() + position + 8, sizeof(lsn));
+        if (data.size() - position - kFrameHeader < size) break;
+        if (crc32(data.data() + position + 8, 8 + size) != crc) break;
+        JournalRecord record(data.substr(position + kFrameHeader, size));
+        fn(lsn, record);
+        position += kFrameHeader + size;
+    }
+    return static_cast<long long>(position);
+}
+
+// Ghi ra tệp tạm, fsync rồi đổi tên đè lên tệp đích để không bao giờ còn checkpoint dở dang.
+bool Journal::writeFileDurably(const string& path, const string& content) {
+    TraceSpan span("writeFileDurably", "io");
+    string temp = path + ".tmp";
+    int out = openFile(temp, true);
+    if (out < 0) return false;
+    bool ok = writeAll(out, content);
+    syncFile(out);
+    closeFile(out);
+    if (!ok) return false;
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool Journal::open(const string& journalFile, uint64_t firstLsn, long long validBytes) {
+    close();
+    fd = openFile(journalFile, false);
+    if (fd < 0) return false;
+    path = journalFile;
+    nextLsn = firstLsn;
+    unsynced = 0;
+    sinceCheckpoint = 0;
+    lastSync = std::chrono::steady_clock::now();
+    tailTruncated = validBytes >= 0 && fileSize(fd) > validBytes;
+    if (tailTruncated) {
+        truncateFile(fd, validBytes);
+        syncFile(fd);
+    }
+    return true;
+}
+
+bool Journal::append(const JournalRecord& record) {
+    TraceSpan span("journal.append", "io");
+    if (fd < 0) return false;
+    if (!writeAll(fd, frame(nextLsn, record.payload()))) return false;
+    ++nextLsn;
+    ++unsynced;
+    ++sinceCheckpoint;
+    // Group commit: gom fsync theo số bản ghi; thao tác lẻ sau một khoảng nghỉ được fsync ngay.
+    auto now = std::chrono::steady_clock::now();
+    if (unsynced >= kGroupCommitRecords ||
+        now - lastSync >= std::chrono::milliseconds(kGroupCommitMillis)) {
+        sync();
+    }
+    return true;
+}
+
+void Journal::sync() {
+    TraceSpan span("journal.fsync", "io");
+    if (fd < 0 || unsynced == 0) return;
+    syncFile(fd);
+    unsynced = 0;
+    lastSync = std::chrono::steady_clock::now();
+}
+
+bool Journal::truncate() {
+    if (fd < 0 || !truncateFile(fd, 0)) return false;
+    syncFile(fd);
+    unsynced = 0;
+    sinceCheckpoint = 0;
+    return true;
+}
+
+void Journal::close() {
+    if (fd < 0) return;
+    sync();
+    closeFile(fd);
+    fd = -1;
+}
+
+bool LibrarySystem::journalExists(const string& path) {
+    return std::ifstream(path).is_open() || std::ifstream(path + ".snapshot").is_open();
+}
+
+// Ghi toàn bộ trạng thái hiện tại thành snapshot rồi làm rỗng journal. Snapshot ghi
+// kèm LSN cuối đã bao gồm, nên nếu chết trước khi cắt journal thì lúc nạp lại các
+// bản ghi cũ trong journal sẽ bị bỏ qua.
+bool LibrarySystem::checkpoint() {
+    ScopedTimer timer(metrics, MetricOp::Checkpoint);
+    TraceSpan span("checkpoint");
+    waitForCatalog();
+    if (!journal.isOpen()) return false;
+    journal.sync();
+    if (!writeSnapshot(journalPath + ".snapshot", journal.lastLsn())) {
+        report(EventCode::SnapshotWriteFailed, 0, 0, 0, journalPath + ".snapshot");
+        return false;
+    }
+    return journal.truncate();
+}
+
+void LibrarySystem::syncJournal() {
+    journal.sync();
+}
+
+bool LibrarySystem::journaling() const {
+    return journal.isOpen() && !replayingJournal;
+}
+
+void LibrarySystem::logMutation(const JournalRecord& record) {
+    if (!journal.append(record)) {
+        report(EventCode::JournalWriteFailed, 0, 0, 0, journalPath);
+        return;
+    }
+    // Đang nạp nền thì để dành checkpoint, không chặn người dùng chờ catalog.
+    if (journal.recordsSinceCheckpoint() >= kCheckpointInterval && !isCatalogLoading()) checkpoint();
+}
+
+// Bản ghi mang sẵn id nên đặt lại bộ đếm trước khi gọi thao tác tương ứng; nhờ vậy
+// id nạp lại trùng với id cũ kể cả khi có khoảng trống do xoá.
+void LibrarySystem::applyJournalRecord(JournalRecord& record) {
+    switch (record.readInt()) {
+    case OpAddBook: {
+        int bookId = static_cast<int>(record.readInt());
+        int firstCopyId = static_cast<int>(record.readInt());
+        string isbn = record.readString();
+        string title = record.readString();
+        string author = record.readString();
+        string subject = record.readString();
+        int year = static_cast<int>(record.readInt());
+        string language = record.readString();
+        int pages = static_cast<int>(record.readInt());
+        string rack = record.readString();
+        string description = record.readString();
+        int numCopies = static_cast<int>(record.readInt());
+        if (record.failed() || bookTable.find(bookId) >= 0) return;
+        nextBookId = bookId;
+        nextCopyId = firstCopyId;
+        addBook(isbn, title, author, subject, year, language, pages, rack, description, numCopies);
+        break;
+    }
+    case OpEditBook: {
+        int bookId = static_cast<int>(record.readInt());
+        string title = record.readString();
+        string author = record.readString();
+        string subject = record.readString();
+        int year = static_cast<int>(record.readInt());
+        string language = record.readString();
+        int pages = static_cast<int>(record.readInt());
+        string rack = record.readString();
+        string description = record.readString();
+        if (record.failed()) return;
+        editBook(bookId, title, author, subject, year, language, pages, rack, description);
+        break;
+    }
+    case OpRemoveBook: {
+        int bookId = static_cast<int>(record.readInt());
+        if (!record.failed()) removeBook(bookId);
+        break;
+    }
+    case OpRegisterMember: {
+        int memberId = static_cast<int>(record.readInt());
+        string name = record.readString();
+        string dob = record.readString();
+        Gender gender = static_cast<Gender>(record.readInt());
+        string address = record.readString();
+        string phone = record.readString();
+        string email = record.readString();
+        string hash = record.readString();
+        NotificationPreference pref = static_cast<NotificationPreference>(record.readInt());
+        AccountRole role = static_cast<AccountRole>(record.readInt());
+        if (record.failed() || memberTable.find(memberId) >= 0 || findMemberByEmail(email)) return;
+        LibraryCard card;
+        card.cardNumber = "CARD-" + std::to_string(memberId);
+        card.issuedDate = "Today";
+        card.active = true;
+        MemberAccount account(memberId, name, dob, gender, address, phone, email, "", pref, card, role);
+        account.restorePasswordHash(hash);
+        insertMember(std::move(account));
+        break;
+    }
+    case OpRemoveMember: {
+        string email = record.readString();
+        if (!record.failed()) removeMember(email);
+        break;
+    }
+    case OpChangePassword: {
+        int memberId = static_cast<int>(record.readInt());
+        string hash = record.readString();
+        MemberAccount* m = findMemberById(memberId);
+        if (!record.failed() && m) m->restorePasswordHash(hash);
+        break;
+    }
+    case OpBorrow: {
+        int loanId = static_cast<int>(record.readInt());
+        int memberId = static_cast<int>(record.readInt());
+        int today = static_cast<int>(record.readInt());
+        vector<int> copyIds(static_cast<size_t>(std::max<int64_t>(record.readInt(), 0)));
+        for (int& copyId : copyIds) copyId = static_cast<int>(record.readInt());
+        if (record.failed() || loanTable.find(loanId) >= 0) return;
+        insertLoan(Loan(loanId, memberId, copyIds, today, today + 14), true);
+        break;
+    }
+    case OpReturn: {
+        int loanId = static_cast<int>(record.readInt());
+        int returnDate = static_cast<int>(record.readInt());
+        Loan* loan = findLoanById(loanId);
+        if (!record.failed() && loan && isLoanOpen(*loan)) finishReturn(*loan, returnDate);
+        break;
+    }
+    case OpRenew: {
+        int loanId = static_cast<int>(record.readInt());
+        int extraDays = static_cast<int>(record.readInt());
+        Loan* loan = findLoanById(loanId);
+        if (!record.failed() && loan) finishRenew(*loan, extraDays);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+
+namespace {
+    // Định dạng snapshot phiên bản 1 (thứ tự byte của máy ghi). Mọi section bắt đầu ở
+    // offset chia hết cho 8; chuỗi nằm chung một vùng và được tham chiếu bằng offset/độ dài.
+    const char kSnapshotMagic[8] = { 'L', 'I', 'B', 'S', 'N', 'A', 'P', '\0' };
+    const uint32_t kSnapshotVersion = 1;
+
+    struct StringRef {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct SnapshotSection {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t fileSize;
+        uint64_t lsn;
+        int32_t nextMemberId;
+        int32_t nextBookId;
+        int32_t nextCopyId;
+        int32_t nextLoanId;
+        SnapshotSection books;
+        SnapshotSection copies;
+        SnapshotSection members;
+        SnapshotSection loans;
+        SnapshotSection loanItems;
+        SnapshotSection strings;
+    };
+
+    struct BookRecord {
+        int32_t id;
+        int32_t firstCopyId;
+        int32_t copyCount;
+        int32_t year;
+        int32_t pages;
+        StringRef isbn;
+        StringRef title;
+        StringRef author;
+        StringRef subject;
+        StringRef language;
+        StringRef rack;
+        StringRef description;
+    };
+
+    struct CopyRecord {
+        int32_t id;
+        int32_t bookId;
+        StringRef barcode;
+        StringRef location;
+    };
+
+    struct MemberRecord {
+        int32_t id;
+        int32_t gender;
+        int32_t preference;
+        int32_t role;
+        int32_t cardActive;
+        StringRef name;
+        StringRef dob;
+        StringRef address;
+        StringRef phone;
+        StringRef email;
+        StringRef passwordHash;
+        StringRef cardNumber;
+        StringRef issuedDate;
+    };
+
+    struct LoanRecord {
+        double fine;
+        int32_t id;
+        int32_t memberId;
+        int32_t borrowDate;
+        int32_t dueDate;
+        int32_t returnDate;
+        int32_t renewalCount;
+        int32_t status;
+        int32_t open;
+        uint32_t firstItem;
+        uint32_t itemCount;
+    };
+
+    class SnapshotBuilder {
+    private:
+        string heap;
+    public:
+        StringRef add(const string& text) {
+            StringRef ref{ static_cast<uint32_t>(heap.size()), static_cast<uint32_t>(text.size()) };
+            heap += text;
+            return ref;
+        }
+        const string& strings() const { return heap; }
+    };
+
+    template <typename Record>
+    SnapshotSection appendSection(string& out, const vector<Record>& records) {
+        out.resize((out.size() + 7) & ~size_t(7), '\0');
+        SnapshotSection section{ out.size(), records.size() };
+        out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+        return section;
+    }
+
+    // Ánh xạ tệp chỉ đọc vào bộ nhớ; trên Windows đọc cả tệp vào bộ đệm.
+    class MappedFile {
+    private:
+        const char* bytes{ nullptr };
+        size_t length{ 0 };
+#ifdef _WIN32
+        string buffer;
+#else
+        void* mapping{ nullptr };
+#endif
+    public:
+        explicit MappedFile(const string& path) {
+#ifdef _WIN32
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open()) return;
+            buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            bytes = buffer.data();
+            length = buffer.size();
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat info;
+            if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+                void* p = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    mapping = p;
+                    bytes = static_cast<const char*>(p);
+                    length = static_cast<size_t>(info.st_size);
+                    ::madvise(p, length, MADV_SEQUENTIAL);
+                }
+            }
+            ::close(fd);
+#endif
+        }
+        ~MappedFile() {
+#ifndef _WIN32
+            if (mapping) ::munmap(mapping, length);
+#endif
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return bytes; }
+        size_t size() const { return length; }
+    };
+
+    template <typename Record>
+    bool sectionFits(const SnapshotSection& section, size_t fileSize) {
+        return section.offset <= fileSize &&
+               section.count <= (fileSize - section.offset) / sizeof(Record);
+    }
+
+    template <typename Record>
+    Record readRecord(const char* base, const SnapshotSection& section, size_t index) {
+        Record record;
+        std::memcpy(&record, base + section.offset + index * sizeof(Record), sizeof(Record));
+        return record;
+    }
+}
+
+bool LibrarySystem::writeSnapshot(const string& path, uint64_t lsn) const {
+    TraceSpan span("writeSnapshot", "io");
+    waitForCatalog();
+    SnapshotBuilder heap;
+
+    vector<BookRecord> bookRecords;
+    bookRecords.reserve(books.size());
+    for (const auto& b : books) {
+        if (b.isRemoved()) continue;
+        const CopyGroup& group = copyGroups[b.getId()];
+        bookRecords.push_back(BookRecord{ b.getId(), group.getFirstCopyId(), group.getTotal(),
+            b.getPublicationYear(), b.getPages(),
+            heap.add(b.getIsbn()), heap.add(b.getTitle()), heap.add(b.getAuthor()), heap.add(b.getSubject()),
+            heap.add(b.getLanguage()), heap.add(b.getRackPosition()), heap.add(b.getDescription()) });
+    }
+
+    vector<CopyRecord> copyRecords;
+    copyRecords.reserve(copies.size());
+    for (const auto& c : copies) {
+        if (c.isRemoved()) continue;
+        copyRecords.push_back(CopyRecord{ c.getId(), c.getBookId(), heap.add(c.getBarcode()), heap.add(c.getLocation()) });
+    }
+
+    vector<MemberRecord> memberRecords;
+    for (size_t i = 0; i < members.size(); ++i) {
+        const MemberAccount& m = members[i];
+        if (memberTable.find(m.getId()) != static_cast<int>(i)) continue;
+        memberRecords.push_back(MemberRecord{ m.getId(), static_cast<int32_t>(m.getGender()),
+            static_cast<int32_t>(m.getPreference()), static_cast<int32_t>(m.getRole()), m.getCard().active ? 1 : 0,
+            heap.add(m.getName()), heap.add(m.getDateOfBirth()), heap.add(m.getAddress()), heap.add(m.getPhone()),
+            heap.add(m.getEmail()), heap.add(m.getPasswordHash()),
+            heap.add(m.getCard().cardNumber), heap.add(m.getCard().issuedDate) });
+    }
+
+    vector<LoanRecord> loanRecords;
+    vector<int32_t> loanItems;
+    loanRecords.reserve(loans.size());
+    for (const auto& loan : loans) {
+        const vector<int>& items = loan.getBookItemIds();
+        loanRecords.push_back(LoanRecord{ loan.getFine(), loan.getId(), loan.getMemberId(),
+            loan.getBorrowDate(), loan.getDueDate(), loan.getReturnDate(), loan.getRenewalCount(),
+            static_cast<int32_t>(loan.getStatus()), isLoanOpen(loan) ? 1 : 0,
+            static_cast<uint32_t>(loanItems.size()), static_cast<uint32_t>(items.size()) });
+        loanItems.insert(loanItems.end(), items.begin(), items.end());
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.lsn = lsn;
+    header.nextMemberId = nextMemberId;
+    header.nextBookId = nextBookId;
+    header.nextCopyId = nextCopyId;
+    header.nextLoanId = nextLoanId;
+
+    string out(sizeof(SnapshotHeader), '\0');
+    header.books = appendSection(out, bookRecords);
+    header.copies = appendSection(out, copyRecords);
+    header.members = appendSection(out, memberRecords);
+    header.loans = appendSection(out, loanRecords);
+    header.loanItems = appendSection(out, loanItems);
+    header.strings = SnapshotSection{ out.size(), heap.strings().size() };
+    out += heap.strings();
+    header.fileSize = out.size();
+    std::memcpy(&out[0], &header, sizeof(header));
+
+    return Journal::writeFileDurably(path, out);
+}
+
+namespace {
+    bool readSnapshotHeader(const MappedFile& file, SnapshotHeader& header) {
+        if (!file.data() || file.size() < sizeof(SnapshotHeader)) return false;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+            header.version != kSnapshotVersion || header.headerSize != sizeof(SnapshotHeader) ||
+            header.fileSize != file.size()) {
+            return false;
+        }
+        const size_t size = file.size();
+        return sectionFits<BookRecord>(header.books, size) && sectionFits<CopyRecord>(header.copies, size) &&
+               sectionFits<MemberRecord>(header.members, size) && sectionFits<LoanRecord>(header.loans, size) &&
+               sectionFits<int32_t>(header.loanItems, size) && sectionFits<char>(header.strings, size);
+    }
+
+    // Đọc chuỗi từ vùng chuỗi của snapshot; tham chiếu vượt biên được ghi nhận là hỏng.
+    class SnapshotText {
+    private:
+        const char* heap;
+        uint64_t heapSize;
+    public:
+        bool damaged{ false };
+
+        explicit SnapshotText(const char* base) {
+            SnapshotHeader header;
+            std::memcpy(&header, base, sizeof(header));
+            heap = base + header.strings.offset;
+            heapSize = header.strings.count;
+        }
+        string operator()(const StringRef& ref) {
+            if (uint64_t(ref.offset) + ref.size > heapSize) {
+                damaged = true;
+                return string();
+            }
+            return string(heap + ref.offset, ref.size);
+        }
+    };
+
+    SnapshotHeader headerOf(const char* base) {
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        return header;
+    }
+}
+
+// Nạp thẳng từ vùng nhớ ánh xạ vào các vector đã reserve đủ chỗ, không qua addBook /
+// registerMember nên không in thông báo và không băm lại mật khẩu.
+bool LibrarySystem::loadSnapshot(const string& path, uint64_t* lsn) {
+    ScopedTimer timer(metrics, MetricOp::LoadSnapshot);
+    TraceSpan span("loadSnapshot");
+    waitForCatalog();
+    if (!books.empty() || !members.empty() || !loans.empty()) return false;
+    MappedFile file(path);
+    SnapshotHeader header;
+    if (!readSnapshotHeader(file, header)) return false;
+
+    searchIndexesStale.store(true, std::memory_order_relaxed);
+    bool intact = loadSnapshotMembers(file.data());
+    intact = loadSnapshotCatalog(file.data()) && intact;
+    intact = loadSnapshotLoans(file.data()) && intact;
+    if (lsn) *lsn = header.lsn;
+    if (!intact) report(EventCode::SnapshotDamaged, 0, 0, 0, path);
+    return true;
+}
+
+// Thành viên và các bộ đếm id; đủ để đăng nhập/đăng ký trước khi có catalog.
+bool LibrarySystem::loadSnapshotMembers(const char* base) {
+    TraceSpan span("loadSnapshotMembers", "io");
+    SnapshotHeader header = headerOf(base);
+    SnapshotText text(base);
+    for (size_t i = 0; i < header.members.count; ++i) {
+        MemberRecord r = readRecord<MemberRecord>(base, header.members, i);
+        LibraryCard card;
+        card.cardNumber = text(r.cardNumber);
+        card.issuedDate = text(r.issuedDate);
+        card.active = r.cardActive != 0;
+        MemberAccount account(r.id, text(r.name), text(r.dob), static_cast<Gender>(r.gender),
+            text(r.address), text(r.phone), text(r.email), "",
+            static_cast<NotificationPreference>(r.preference), card, static_cast<AccountRole>(r.role));
+        account.restorePasswordHash(text(r.passwordHash));
+        if (r.id <= 0 || r.id >= header.nextMemberId ||
+            findMemberByEmail(account.getEmail()) || memberTable.find(r.id) >= 0) {
+            text.damaged = true;
+            continue;
+        }
+        insertMember(std::move(account));
+    }
+
+    nextMemberId = std::max(nextMemberId, header.nextMemberId);
+    nextBookId = std::max(nextBookId, header.nextBookId);
+    nextCopyId = std::max(nextCopyId, header.nextCopyId);
+    nextLoanId = std::max(nextLoanId, header.nextLoanId);
+    return !text.damaged;
+}
+
+bool LibrarySystem::loadSnapshotCatalog(const char* base) {
+    TraceSpan span("loadSnapshotCatalog", "io");
+    SnapshotHeader header = headerOf(base);
+    SnapshotText text(base);
+    books.reserve(header.books.count);
+    isbnIndex.reserve(header.books.count);
+    copyGroups.reserve(static_cast<size_t>(std::max(header.nextBookId, 1)));
+    // Id phải nhỏ hơn bộ đếm trong header: một id hỏng rất lớn sẽ làm IdTable / copyGroups
+    // cấp phát hàng GB. Nhóm bản sao cũng phải nằm trong dải id bản sao đã cấp.
+    for (size_t i = 0; i < header.books.count; ++i) {
+        if (i % kCatalogLoadBatch == 0) yieldCatalogLock();
+        BookRecord r = readRecord<BookRecord>(base, header.books, i);
+        bool copiesInRange = r.copyCount == 0 ||
+            (r.firstCopyId > 0 && r.copyCount > 0 && r.copyCount <= header.nextCopyId - r.firstCopyId);
+        if (r.id <= 0 || r.id >= header.nextBookId || bookTable.find(r.id) >= 0 || !copiesInRange) {
+            text.damaged = true;
+            continue;
+        }
+        books.emplace_back(r.id, text(r.isbn), text(r.title), text(r.author), text(r.subject),
+                           r.year, text(r.language), r.pages, text(r.rack), text(r.description));
+        bookTable.set(r.id, static_cast<int>(books.size() - 1));
+        indexBook(books.back());
+        if (static_cast<size_t>(r.id) >= copyGroups.size()) copyGroups.resize(static_cast<size_t>(r.id) + 1);
+        copyGroups[r.id] = CopyGroup(r.firstCopyId, std::max(r.copyCount, 0));
+    }
+
+    copies.reserve(header.copies.count);
+    barcodeIndex.reserve(header.copies.count);
+    for (size_t i = 0; i < header.copies.count; ++i) {
+        if (i % kCatalogLoadBatch == 0) yieldCatalogLock();
+        CopyRecord r = readRecord<CopyRecord>(base, header.copies, i);
+        if (r.id <= 0 || r.id >= header.nextCopyId || copyTable.find(r.id) >= 0 ||
+            bookTable.find(r.bookId) < 0 || !copyGroups[r.bookId].contains(r.id)) {
+            text.damaged = true;
+            continue;
+        }
+        copies.emplace_back(r.id, r.bookId, text(r.barcode), true, text(r.location));
+        copyTable.set(r.id, static_cast<int>(copies.size() - 1));
+        barcodeIndex[copies.back().getBarcode()] = r.id;
+    }
+    ++catalogGeneration;
+    return !text.damaged;
+}
+
+bool LibrarySystem::loadSnapshotLoans(const char* base) {
+    TraceSpan span("loadSnapshotLoans", "io");
+    SnapshotHeader header = headerOf(base);
+    bool intact = true;
+    loans.reserve(header.loans.count);
+    for (size_t i = 0; i < header.loans.count; ++i) {
+        LoanRecord r = readRecord<LoanRecord>(base, header.loans, i);
+        if (uint64_t(r.firstItem) + r.itemCount > header.loanItems.count ||
+            r.id <= 0 || r.id >= header.nextLoanId || loanTable.find(r.id) >= 0) {
+            intact = false;
+            continue;
+        }
+        vector<int> items(r.itemCount);
+        bool resolved = true;
+        for (uint32_t k = 0; k < r.itemCount; ++k) {
+            items[k] = readRecord<int32_t>(base, header.loanItems, r.firstItem + k);
+            resolved = resolved && findCopyById(items[k]) != nullptr;
+        }
+        // Phiếu đang mở phải trỏ tới thành viên và bản sao đã nạp, nếu không sẽ đánh dấu
+        // nhầm bản sao / nhóm của sách khác.
+        if (r.open != 0 && (!resolved || memberTable.find(r.memberId) < 0)) {
+            intact = false;
+            continue;
+        }
+        insertLoan(Loan(r.id, r.memberId, items, r.borrowDate, r.dueDate, r.returnDate,
+                        r.renewalCount, static_cast<LoanStatus>(r.status), r.fine), r.open != 0);
+    }
+    return intact;
+}
+
+namespace {
+    bool isMemberRecord(const JournalRecord& record) {
+        JournalRecord peek = record;
+        int64_t op = peek.readInt();
+        return op == OpRegisterMember || op == OpRemoveMember || op == OpChangePassword;
+    }
+}
+
+bool LibrarySystem::openJournal(const string& path, bool backgroundCatalog) {
+    ScopedTimer timer(metrics, MetricOp::OpenJournal);
+    TraceSpan span("openJournal");
+    waitForCatalog();
+    if (catalogLoader.joinable()) catalogLoader.join();
+    journal.close();
+    journalPath = path;
+    bool existed = journalExists(path);
+    string snapshotPath = path + ".snapshot";
+
+    auto snapshot = std::make_shared<MappedFile>(snapshotPath);
+    SnapshotHeader header;
+    bool hasSnapshot = snapshot->data() != nullptr;
+    bool validSnapshot = hasSnapshot && readSnapshotHeader(*snapshot, header) &&
+                         books.empty() && members.empty() && loans.empty();
+    if (hasSnapshot && !validSnapshot) report(EventCode::SnapshotReadFailed, 0, 0, 0, snapshotPath);
+    bool background = backgroundCatalog && validSnapshot;
+
+    uint64_t checkpointLsn = validSnapshot ? header.lsn : 0;
+    uint64_t lastLsn = checkpointLsn;
+    vector<JournalRecord> deferred;
+    bool intact = true;
+
+    replayingJournal = true;
+    if (validSnapshot) {
+        searchIndexesStale.store(true, std::memory_order_relaxed);
+        intact = loadSnapshotMembers(snapshot->data());
+        if (!background) {
+            intact = loadSnapshotCatalog(snapshot->data()) && intact;
+            intact = loadSnapshotLoans(snapshot->data()) && intact;
+        }
+    }
+    // Khi nạp nền, bản ghi về thành viên được áp dụng ngay (chúng không phụ thuộc
+    // catalog); phần còn lại giữ nguyên thứ tự và được phát lại sau khi nạp catalog.
+    long long validBytes = Journal::readAll(path, [&](uint64_t lsn, JournalRecord& record) {
+        if (lsn <= checkpointLsn) return;
+        lastLsn = lsn;
+        if (background && !isMemberRecord(record)) deferred.push_back(record);
+        else applyJournalRecord(record);
+    });
+    replayingJournal = false;
+
+    if (!journal.open(path, lastLsn + 1, validBytes)) {
+        report(EventCode::JournalOpenFailed, 0, 0, 0, path);
+        return false;
+    }
+    if (journal.truncatedTail()) report(EventCode::JournalTailTruncated, 0, 0, 0, path);
+    if (!background) {
+        if (!intact) report(EventCode::SnapshotDamaged, 0, 0, 0, snapshotPath);
+        return existed || checkpoint();
+    }
+
+    catalogBooksTotal = header.books.count;
+    catalogBooksLoaded.store(0, std::memory_order_relaxed);
+    catalogReady.store(false, std::memory_order_release);
+    catalogLoader = std::thread([this, snapshot, snapshotPath, intact, deferred = std::move(deferred)]() mutable {
+        ScopedTimer timer(metrics, MetricOp::LoadSnapshot);
+        TraceSpan span("loadCatalogInBackground");
+        catalogLockDepth = 1;
+        replayingJournal = true;
+        std::unique_lock<std::shared_mutex> lock(catalogMutex);
+        loaderLock = &lock;
+        // Chừa chỗ cho sách thêm qua journal để con trỏ Book* đã trả cho truy vấn
+        // từng phần không bị vô hiệu khi vector books cấp phát lại. removeBook trong
+        // journal chỉ đánh dấu tombstone và không dồn vector khi đang nạp, nên các
+        // phần tử đã nạp cũng không bị dịch chỗ.
+        books.reserve(headerOf(snapshot->data()).books.count + deferred.size());
+        intact = loadSnapshotCatalog(snapshot->data()) && intact;
+        intact = loadSnapshotLoans(snapshot->data()) && intact;
+        for (auto& record : deferred) applyJournalRecord(record);
+        catalogBooksLoaded.store(books.size(), std::memory_order_relaxed);
+        loaderLock = nullptr;
+        lock.unlock();
+        snapshot.reset();
+
+        // Truy vấn từng phần không dùng chỉ mục tìm kiếm nên có thể dựng sau khi nhả khoá.
+        ensureSearchIndexes();
+        replayingJournal = false;
+        catalogLockDepth = 0;
+        if (!intact) report(EventCode::SnapshotDamaged, 0, 0, 0, snapshotPath);
+        finishCatalogLoad();
+    });
+    return true;
+}
+
+
+namespace {
+    const size_t kImportChunkBytes = 1 << 20;
+
+    // Kết quả phân tích một đoạn tệp; số dòng (của cả lỗi lẫn dòng hợp lệ) tính từ đầu
+    // đoạn, được cộng bù thành số dòng trong tệp khi ghép.
+    template <typename Row>
+    struct ParsedChunk {
+        vector<Row> rows;
+        vector<ImportError> errors;
+        size_t lineCount{};
+    };
+
+    size_t splitFields(std::string_view line, std::string_view* fields, size_t maxFields) {
+        size_t count = 0;
+        while (count < maxFields) {
+            size_t bar = line.find('|');
+            fields[count++] = line.substr(0, bar);
+            if (bar == std::string_view::npos) return count;
+            line.remove_prefix(bar + 1);
+        }
+        return count + 1;
+    }
+
+    bool parseInt(std::string_view text, int& value) {
+        const char* end = text.data() + text.size();
+        auto result = std::from_chars(text.data(), end, value);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+
+    // Cắt vùng đệm thành các đoạn kết thúc ở ký tự xuống dòng rồi phân tích song song.
+    // parseLine(line, localLineNumber, chunk) tự thêm dòng hợp lệ hoặc lỗi vào chunk;
+    // Row phải có trường line để được cộng bù.
+    template <typename Row, typename ParseLine>
+    vector<ParsedChunk<Row>> parseLinesParallel(const char* data, size_t size, ThreadPool& pool, ParseLine parseLine) {
+        vector<std::pair<size_t, size_t>> ranges;
+        size_t begin = 0;
+        while (begin < size) {
+            size_t end = std::min(size, begin + kImportChunkBytes);
+            const void* newline = end < size ? std::memchr(data + end, '\n', size - end) : nullptr;
+            end = newline ? static_cast<size_t>(static_cast<const char*>(newline) - data) + 1 : size;
+            ranges.emplace_back(begin, end);
+            begin = end;
+        }
+
+        vector<ParsedChunk<Row>> chunks(ranges.size());
+        pool.parallelFor(ranges.size(), [&](size_t k) {
+            TraceSpan span("parseChunk", "import");
+            std::string_view text(data + ranges[k].first, ranges[k].second - ranges[k].first);
+            ParsedChunk<Row>& chunk = chunks[k];
+            while (!text.empty()) {
+                size_t newline = text.find('\n');
+                std::string_view line = text.substr(0, newline);
+                text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+                ++chunk.lineCount;
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if (!line.empty()) parseLine(line, chunk.lineCount, chunk);
+            }
+        });
+
+        size_t base = 0;
+        for (auto& chunk : chunks) {
+            for (auto& error : chunk.errors) error.line += base;
+            for (auto& row : chunk.rows) row.line += base;
+            base += chunk.lineCount;
+        }
+        return chunks;
+    }
+
+    struct BookRow {
+        size_t line;
+        std::string_view isbn, title, author, subject, rack;
+        int year, pages, copies;
+    };
+
+    struct MemberRow {
+        size_t line;
+        std::string_view name, dob, address, phone, email;
+        string passwordHash;
+        Gender gender;
+        NotificationPreference preference;
+        AccountRole role;
+    };
+}
+
+ImportReport LibrarySystem::importBooksFile(const string& path) {
+    ScopedTimer timer(metrics, MetricOp::ImportBooks);
+    TraceSpan span("importBooksFile");
+    waitForCatalog();
+    ImportReport report;
+    MappedFile file(path);
+    if (!file.data()) {
+        report.opened = std::ifstream(path).is_open();
+        return report;
+    }
+    report.opened = true;
+
+    // isbn|title|author|subject|year|pages|rack|copies
+    auto chunks = parseLinesParallel<BookRow>(file.data(), file.size(), sharedPool(),
+        [](std::string_view line, size_t lineNumber, ParsedChunk<BookRow>& chunk) {
+            std::string_view f[8];
+            size_t count = splitFields(line, f, 8);
+            BookRow row{};
+            row.line = lineNumber;
+            if (count < 8) {
+                chunk.errors.push_back({ lineNumber, "thieu truong (can 8, co " + std::to_string(count) + ")" });
+            } else if (!parseInt(f[4], row.year)) {
+                chunk.errors.push_back({ lineNumber, "nam xuat ban khong hop le: " + string(f[4]) });
+            } else if (!parseInt(f[5], row.pages)) {
+                chunk.errors.push_back({ lineNumber, "so trang khong hop le: " + string(f[5]) });
+            } else if (!parseInt(f[7], row.copies) || row.copies < 0) {
+                chunk.errors.push_back({ lineNumber, "so ban sao khong hop le: " + string(f[7]) });
+            } else {
+                row.isbn = f[0];
+                row.title = f[1];
+                row.author = f[2];
+                row.subject = f[3];
+                row.rack = f[6];
+                chunk.rows.push_back(row);
+            }
+        });
+
+    TraceSpan insertSpan("importBooksFile.insert");
+    size_t rowCount = 0;
+    size_t copyCount = 0;
+    for (const auto& chunk : chunks) {
+        rowCount += chunk.rows.size();
+        for (const auto& row : chunk.rows) copyCount += static_cast<size_t>(row.copies);
+    }
+    books.reserve(books.size() + rowCount);
+    copies.reserve(copies.size() + copyCount);
+    isbnIndex.reserve(isbnIndex.size() + rowCount);
+    barcodeIndex.reserve(barcodeIndex.size() + copyCount);
+    // Nhập lớn so với catalog hiện có: dựng lại chỉ mục tìm kiếm một lần khi cần thay vì từng sách.
+    if (rowCount * 4 > books.size()) searchIndexesStale.store(true, std::memory_order_relaxed);
+
+    // Chèn thẳng vào các container đã reserve, không qua addBook: không ghi journal từng
+    // dòng mà chốt một checkpoint sau cùng nếu journal đang mở.
+    copyGroups.resize(std::max(copyGroups.size(), static_cast<size_t>(nextBookId) + rowCount));
+    for (auto& chunk : chunks) {
+        for (const auto& row : chunk.rows) {
+            int bookId = nextBookId++;
+            books.emplace_back(bookId, string(row.isbn), string(row.title), string(row.author),
+                               string(row.subject), row.year, "Vietnamese", row.pages,
+                               string(row.rack), "Imported");
+            bookTable.set(bookId, static_cast<int>(books.size() - 1));
+            indexBook(books.back());
+            insertCopies(bookId, row.copies, books.back().getRackPosition());
+        }
+        report.imported += chunk.rows.size();
+        report.errors.insert(report.errors.end(), chunk.errors.begin(), chunk.errors.end());
+    }
+    if (rowCount > 0) {
+        ++catalogGeneration;
+        if (journaling()) checkpoint();
+    }
+    return report;
+}
+
+ImportReport LibrarySystem::importMembersFile(const string& path) {
+    ScopedTimer timer(metrics, MetricOp::ImportMembers);
+    TraceSpan span("importMembersFile");
+    waitForCatalog();
+    ImportReport report;
+    MappedFile file(path);
+    if (!file.data()) {
+        report.opened = std::ifstream(path).is_open();
+        return report;
+    }
+    report.opened = true;
+
+    // name|dob|gender|address|phone|email|password|pref|role; mật khẩu được băm ngay trên luồng phân tích.
+    auto chunks = parseLinesParallel<MemberRow>(file.data(), file.size(), sharedPool(),
+        [](std::string_view line, size_t lineNumber, ParsedChunk<MemberRow>& chunk) {
+            std::string_view f[9];
+            size_t count = splitFields(line, f, 9);
+            int gender = 0, pref = 0, role = 0;
+            if (count < 9) {
+                chunk.errors.push_back({ lineNumber, "thieu truong (can 9, co " + std::to_string(count) + ")" });
+            } else if (!parseInt(f[2], gender) || !parseInt(f[7], pref) || !parseInt(f[8], role)) {
+                chunk.errors.push_back({ lineNumber, "gioi tinh / tuy chon / vai tro khong hop le" });
+            } else if (f[6].size() < 6) {
+                chunk.errors.push_back({ lineNumber, "mat khau ngan hon 6 ky tu" });
+            } else {
+                MemberRow row{};
+                row.line = lineNumber;
+                row.name = f[0];
+                row.dob = f[1];
+                row.gender = gender == 1 ? Gender::Male : (gender == 2 ? Gender::Female : Gender::Other);
+                row.address = f[3];
+                row.phone = f[4];
+                row.email = f[5];
+                row.passwordHash = PasswordHasher::hash(string(f[6]));
+                row.preference = pref == 2 ? NotificationPreference::PostalMail : NotificationPreference::Email;
+                row.role = role == 2 ? AccountRole::Admin : (role == 1 ? AccountRole::Librarian : AccountRole::Member);
+                chunk.rows.push_back(std::move(row));
+            }
+        });
+
+    TraceSpan insertSpan("importMembersFile.insert");
+    vector<ImportError> duplicates;
+    for (auto& chunk : chunks) {
+        for (const auto& row : chunk.rows) {
+            if (findMemberByEmail(row.email)) {
+                duplicates.push_back({ row.line, "email da ton tai: " + string(row.email) });
+                continue;
+            }
+            LibraryCard card;
+            card.cardNumber = "CARD-" + std::to_string(nextMemberId);
+            card.issuedDate = "Today";
+            card.active = true;
+            MemberAccount account(nextMemberId, string(row.name), string(row.dob), row.gender,
+                string(row.address), string(row.phone), string(row.email), "", row.preference, card, row.role);
+            account.restorePasswordHash(row.passwordHash);
+            logRegisterMember(insertMember(std::move(account)));
+            ++report.imported;
+        }
+        report.errors.insert(report.errors.end(), chunk.errors.begin(), chunk.errors.end());
+    }
+    report.errors.insert(report.errors.end(), duplicates.begin(), duplicates.end());
+    std::sort(report.errors.begin(), report.errors.end(),
+        [](const ImportError& a, const ImportError& b) { return a.line < b.line; });
+    return report;
+}
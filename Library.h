@@ -1,7 +1,23 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 using std::string;
@@ -19,6 +35,12 @@ enum class NotificationPreference {
     PostalMail
 };
 
+enum class AccountRole {
+    Member,
+    Librarian,
+    Admin
+};
+
 enum class LoanStatus {
     Active,
     Returned,
@@ -31,6 +53,20 @@ struct LibraryCard {
     bool active{ true };
 };
 
+// PBKDF2-HMAC-SHA256 với salt ngẫu nhiên. Chuỗi lưu có dạng
+// pbkdf2-sha256$<số vòng>$<salt hex>$<hash hex>; số vòng nằm trong chuỗi nên tăng chi
+// phí về sau không làm hỏng các hash đã lưu. Hash kiểu cũ (std::hash) vẫn kiểm tra được.
+class PasswordHasher {
+public:
+    static constexpr int kDefaultIterations = 100000;
+
+    static void setIterations(int iterations);
+    static int iterations();
+    static string hash(const string& password);
+    static bool verify(const string& password, const string& stored);
+    // true nếu hash là kiểu cũ hoặc có ít vòng hơn cấu hình hiện tại.
+    static bool needsRehash(const string& stored);
+};
 
 class MemberAccount {
 private:
@@ -44,6 +80,7 @@ private:
     string passwordHash;  
     NotificationPreference preference{};
     LibraryCard card;
+    AccountRole role{ AccountRole::Member };
 public:
     MemberAccount() = default;
 
@@ -57,16 +94,22 @@ public:
         const string& email,
         const string& rawPassword,
         NotificationPreference pref,
-        const LibraryCard& card
+        const LibraryCard& card,
+        AccountRole role = AccountRole::Member
     );
 
     int getId() const { return id; }
     const string& getName() const { return fullName; }
+    const string& getDateOfBirth() const { return dateOfBirth; }
+    Gender getGender() const { return gender; }
     const string& getEmail() const { return email; }
     const string& getAddress() const { return address; }
     const string& getPhone() const { return phone; }
     const LibraryCard& getCard() const { return card; }
     NotificationPreference getPreference() const { return preference; }
+    AccountRole getRole() const { return role; }
+    const string& getPasswordHash() const { return passwordHash; }
+    void restorePasswordHash(const string& hash) { passwordHash = hash; }
 
     bool checkPassword(const string& rawPassword) const;
     void changePassword(const string& newRawPassword);
@@ -85,19 +128,21 @@ private:
     int pages{};
     string rackPosition;
     string description;
+    bool removed{ false };
 public:
     Book() = default;
 
+    // Nhận chuỗi theo giá trị rồi move, nên nhập/nạp hàng loạt chỉ cấp phát mỗi trường một lần.
     Book(int id,
-         const string& isbn,
-         const string& title,
-         const string& author,
-         const string& subject,
+         string isbn,
+         string title,
+         string author,
+         string subject,
          int publicationYear,
-         const string& language,
+         string language,
          int pages,
-         const string& rackPosition,
-         const string& description);
+         string rackPosition,
+         string description);
 
     int getId() const { return id; }
     const string& getIsbn() const { return isbn; }
@@ -109,6 +154,9 @@ public:
     int getPages() const { return pages; }
     const string& getRackPosition() const { return rackPosition; }
     const string& getDescription() const { return description; }
+    // Sách đã xoá vẫn nằm lại trong vector cho tới lần dồn kế tiếp; người duyệt phải bỏ qua.
+    bool isRemoved() const { return removed; }
+    void markRemoved() { removed = true; }
 
     void updateInfo(const string& newTitle,
                     const string& newAuthor,
@@ -127,10 +175,11 @@ private:
     string barcode;
     bool available{ true };
     string location;
+    bool removed{ false };
 public:
     BookItem() = default;
 
-    BookItem(int id, int bookId, const string& barcode, bool available, const string& location);
+    BookItem(int id, int bookId, string barcode, bool available, string location);
 
     int getId() const { return id; }
     int getBookId() const { return bookId; }
@@ -138,6 +187,8 @@ public:
     const string& getLocation() const { return location; }
     bool isAvailable() const { return available; }
     void setAvailable(bool value) { available = value; }
+    bool isRemoved() const { return removed; }
+    void markRemoved() { removed = true; }
 };
 
 class Loan {
@@ -160,6 +211,17 @@ public:
          int borrowDate,
          int dueDate);
 
+    // Dựng lại phiếu mượn với đầy đủ trạng thái khi nạp checkpoint.
+    Loan(int id,
+         int memberId,
+         const vector<int>& bookItemIds,
+         int borrowDate,
+         int dueDate,
+         int returnDate,
+         int renewalCount,
+         LoanStatus status,
+         double fine);
+
     int getId() const { return id; }
     int getMemberId() const { return memberId; }
     const vector<int>& getBookItemIds() const { return bookItemIds; }
@@ -169,6 +231,8 @@ public:
     int getRenewalCount() const { return renewalCount; }
     LoanStatus getStatus() const { return status; }
     double getFine() const { return fine; }
+    // Chưa trả sách: Active, hoặc Overdue do lượt quét hạn đánh dấu.
+    bool isOut() const { return status == LoanStatus::Active || (status == LoanStatus::Overdue && returnDate == 0); }
 
     void markReturned(int actualReturnDate, double finePerDay);
     bool canRenew(int maxRenewals) const;
@@ -194,14 +258,810 @@ public:
     void cancel() { active = false; }
 };
 
+// Bộ nhớ của một container, ước lượng theo bố cục của libstdc++. inlineBytes là phần
+// cấp phát cho chính phần tử (cả nút/bucket với map), stringBytes là bộ đệm chuỗi nằm
+// ngoài SSO, otherHeapBytes là các vector lồng bên trong phần tử.
+struct ContainerMemory {
+    string name;
+    size_t count{};
+    size_t capacity{};
+    size_t inlineBytes{};
+    size_t stringBytes{};
+    size_t otherHeapBytes{};
+
+    size_t totalBytes() const { return inlineBytes + stringBytes + otherHeapBytes; }
+};
+
+// Bảng tra cứu id -> vị trí trong vector. Id được cấp tuần tự nên dùng mảng
+// trực tiếp; ô của bản ghi đã xoá mang giá trị -1 (tombstone).
+class IdTable {
+private:
+    vector<int> slots;
+public:
+    void set(int id, int position);
+    void erase(int id);
+    int find(int id) const;
+    void clear() { slots.clear(); }
+    ContainerMemory memoryUsage() const;
+};
+
+// Các bản sao của một đầu sách được cấp id liên tiếp trong addBook, nên nhóm chỉ
+// cần id đầu tiên và số lượng. Bit thứ i bật khi bản sao firstCopyId + i còn trên kệ.
+class CopyGroup {
+private:
+    int firstCopyId{};
+    int total{};
+    int available{};
+    int onLoan{};
+    vector<uint64_t> availableBits;
+public:
+    CopyGroup() = default;
+    CopyGroup(int firstCopyId, int total);
+
+    int getFirstCopyId() const { return firstCopyId; }
+    int getTotal() const { return total; }
+    int getAvailable() const { return available; }
+    int getOnLoan() const { return onLoan; }
+    bool contains(int copyId) const { return copyId >= firstCopyId && copyId < firstCopyId + total; }
+
+    void setAvailable(int copyId, bool value);
+    int firstAvailableCopyId() const;
+    void addOnLoan(int delta) { onLoan += delta; }
+    size_t heapBytes() const { return availableBits.capacity() * sizeof(uint64_t); }
+};
+
+// Các phiếu mượn chưa trả của một thành viên và tổng số bản sao đang giữ.
+struct MemberLoanState {
+    vector<int> openLoanIds;
+    int borrowedItems{};
+};
+
+// Vùng nhớ liền mạch chứa văn bản đã chuẩn hoá của mọi sách, mỗi bản ghi kết thúc
+// bằng '\0'. Quét từ khoá chạy thẳng trên vùng nhớ này (SIMD khi CPU hỗ trợ) mà
+// không cấp phát. Bản ghi bị sửa/xoá để lại phần rác, được dồn lại khi rác vượt nửa.
+class TextArena {
+private:
+    struct Record {
+        size_t offset{};
+        size_t length{};
+        int bookId{};
+    };
+    string bytes;
+    vector<Record> records;
+    vector<int> recordOfBook;
+    size_t deadBytes{};
+    size_t liveRecords{};
+    // Id lớn nhất từng được nối vào (kể cả bản ghi đã xoá); thêm id nhỏ hơn thì mất thứ tự.
+    int maxBookId{};
+    bool idOrdered{ true };
+
+    void compact();
+public:
+    static size_t find(const char* haystack, size_t length, std::string_view needle);
+
+    void set(int bookId, std::string_view foldedText);
+    void erase(int bookId);
+    std::string_view text(int bookId) const;
+    bool contains(int bookId, std::string_view needle) const;
+    void scan(std::string_view needle, vector<int>& bookIds) const;
+    size_t size() const { return liveRecords; }
+    ContainerMemory memoryUsage() const;
+};
+
+// Chỉ mục trigram cho bộ lọc từ khoá của searchBooks. Văn bản của mỗi sách là
+// "title description" đã hạ chữ thường; mỗi bộ 3 byte trỏ tới danh sách id sách
+// tăng dần. Truy vấn giao các danh sách rồi kiểm tra lại trên văn bản trong arena.
+class TrigramIndex {
+private:
+    std::unordered_map<uint32_t, vector<int>> postings;
+    TextArena texts;
+
+    static vector<uint32_t> gramsOf(std::string_view text);
+public:
+    static const size_t kGramSize = 3;
+
+    static string fold(const string& text);
+    static void foldInto(const string& text, string& out);
+    static string bookText(const Book& book);
+
+    void add(int bookId, const string& foldedText);
+    void remove(int bookId);
+    bool textContains(int bookId, const string& foldedKeyword) const;
+    bool search(const string& foldedKeyword, vector<int>& bookIds) const;
+    void scan(const string& foldedKeyword, vector<int>& bookIds) const;
+    void clear() { postings.clear(); texts = TextArena(); }
+    // Bảng trigram; vùng văn bản báo riêng qua textMemoryUsage().
+    ContainerMemory memoryUsage() const;
+    ContainerMemory textMemoryUsage() const { return texts.memoryUsage(); }
+};
+
+// Bitmap nén kiểu roaring: giá trị được chia khối theo 16 bit cao. Khối thưa lưu
+// mảng uint16 đã sắp xếp, khối có hơn kArrayLimit phần tử chuyển sang bitset 64K bit.
+class RoaringBitmap {
+private:
+    struct Container {
+        uint16_t key{};
+        int cardinality{};
+        vector<uint16_t> array;
+        vector<uint64_t> bits;
+        bool isBitset() const { return !bits.empty(); }
+    };
+    vector<Container> containers;
+
+    static const int kArrayLimit = 4096;
+    Container* findContainer(uint16_t key);
+    const Container* findContainer(uint16_t key) const;
+    static void toBitset(Container& c);
+    static void toArray(Container& c);
+public:
+    void add(uint32_t value);
+    void remove(uint32_t value);
+    bool contains(uint32_t value) const;
+    size_t cardinality() const;
+    bool empty() const { return containers.empty(); }
+    size_t heapBytes() const;
+
+    RoaringBitmap& operator&=(const RoaringBitmap& other);
+    RoaringBitmap& operator|=(const RoaringBitmap& other);
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const auto& c : containers) {
+            uint32_t high = static_cast<uint32_t>(c.key) << 16;
+            if (c.isBitset()) {
+                for (size_t w = 0; w < c.bits.size(); ++w) {
+                    uint64_t word = c.bits[w];
+                    while (word) {
+                        fn(high | static_cast<uint32_t>(w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            } else {
+                for (uint16_t low : c.array) fn(high | low);
+            }
+        }
+    }
+};
+
+struct FacetCount {
+    string value;
+    int count{};
+};
+
+// Bộ lọc theo giá trị facet chính xác; chuỗi rỗng / năm 0 nghĩa là không lọc.
+struct FacetQuery {
+    string keyword;
+    string subject;
+    int year{};
+    string authorToken;
+};
+
+struct FacetResult {
+    vector<int> bookIds;
+    vector<FacetCount> subjects;
+    vector<FacetCount> years;
+    vector<FacetCount> authorTokens;
+};
+
+// Chỉ mục facet: một bitmap id sách cho mỗi chủ đề, năm xuất bản và từ trong tên tác giả.
+class FacetIndex {
+private:
+    std::map<string, RoaringBitmap> subjects;
+    std::map<int, RoaringBitmap> years;
+    std::map<string, RoaringBitmap> authorTokens;
+public:
+    static vector<string> tokenizeAuthor(const string& author);
+
+    void add(const Book& book);
+    void remove(const Book& book);
+
+    RoaringBitmap subjectsContaining(const string& text) const;
+    RoaringBitmap match(const string& subjectText, int yearValue) const;
+    const RoaringBitmap* subject(const string& value) const;
+    const RoaringBitmap* year(int value) const;
+    const RoaringBitmap* authorToken(const string& token) const;
+    void clear() { subjects.clear(); years.clear(); authorTokens.clear(); }
+    ContainerMemory memoryUsage() const;
+};
+
+// Pool luồng với hàng đợi riêng cho từng luồng: luồng lấy việc mới nhất ở cuối
+// hàng đợi của mình, hết việc thì lấy việc cũ nhất ở đầu hàng đợi luồng khác.
+class ThreadPool {
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    vector<std::unique_ptr<WorkQueue>> queues;
+    vector<std::thread> threads;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<size_t> nextQueue{ 0 };
+    bool stopping{ false };
+
+    bool runOne(size_t preferredQueue);
+    void workerLoop(size_t index);
+public:
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return threads.size(); }
+    void submit(std::function<void()> task);
+    // Chạy fn(0..count-1) song song và chờ xong; luồng gọi cũng tham gia làm việc.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+};
+
+enum class SearchMode {
+    Auto,
+    FullScan
+};
+
+struct QueryCacheStats {
+    size_t hits{};
+    size_t misses{};
+    size_t entries{};
+    size_t capacity{};
+};
+
+// Cache LRU: truy vấn đã chuẩn hoá -> danh sách id. Mỗi mục ghi kèm thế hệ catalog
+// lúc tính; thế hệ khác với hiện tại thì coi như trượt. Chỉ lưu id, số bản còn lại
+// được tra lại khi đọc nên không bị lệch sau mượn/trả.
+class QueryCache {
+private:
+    struct Entry {
+        string key;
+        uint64_t generation{};
+        vector<int> bookIds;
+    };
+    std::list<Entry> recent;
+    std::unordered_map<string, std::list<Entry>::iterator> entries;
+    size_t capacity;
+    size_t hits{ 0 };
+    size_t misses{ 0 };
+    mutable std::mutex mutex;
+public:
+    explicit QueryCache(size_t capacity = 256) : capacity(capacity) {}
+
+    static string makeKey(const string& foldedKeyword,
+                          const string& author,
+                          const string& subject,
+                          int year,
+                          SearchMode mode);
+    bool find(const string& key, uint64_t generation, vector<int>& bookIds);
+    void store(const string& key, uint64_t generation, const vector<int>& bookIds);
+    void clear();
+    QueryCacheStats stats() const;
+    ContainerMemory memoryUsage() const;
+};
+
+// Một trang kết quả tìm kiếm. Con trỏ Book chỉ hợp lệ tới lần sửa catalog kế tiếp;
+// nextCursor = -1 khi đã hết, ngược lại truyền lại làm afterId để lấy trang sau.
+struct SearchHit {
+    const Book* book{};
+    int availableCopies{};
+};
+
+struct SearchPage {
+    vector<SearchHit> hits;
+    int nextCursor{ -1 };
+    // true khi catalog còn đang nạp nền: trang chỉ gồm các sách đã nạp xong.
+    bool partial{ false };
+};
+
+struct Suggestion {
+    int bookId{};
+    string completion;
+    string title;
+    string author;
+    int availableCopies{};
+};
+
+// Từ điển từ đã sắp xếp (title + tác giả, đã hạ chữ thường) cho gợi ý khi gõ.
+// Các từ có chung tiền tố nằm liền nhau nên chỉ cần quét một đoạn của map.
+class PrefixIndex {
+private:
+    std::map<string, vector<int>> terms;
+public:
+    static vector<string> words(const string& text);
+
+    void add(const Book& book);
+    void remove(const Book& book);
+
+    template <typename Fn>
+    void forEachCompletion(const string& prefix, Fn fn) const {
+        for (auto it = terms.lower_bound(prefix);
+             it != terms.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            for (int bookId : it->second) {
+                if (!fn(it->first, bookId)) return;
+            }
+        }
+    }
+    const vector<int>* postings(const string& term) const;
+    void clear() { terms.clear(); }
+    ContainerMemory memoryUsage() const;
+};
+
+struct FuzzyMatch {
+    int bookId{};
+    int distance{};
+};
+
+// Tìm kiếm gần đúng theo từ: từ điển các từ (đã bỏ dấu tiếng Việt) của tên sách và
+// tác giả được xếp vào cây BK theo khoảng cách Levenshtein, nên mỗi truy vấn chỉ
+// duyệt các nhánh có thể nằm trong ngưỡng thay vì quét toàn bộ kho sách.
+class FuzzyIndex {
+private:
+    struct Node {
+        int termId{};
+        vector<std::pair<int, int>> children;
+    };
+    vector<string> termTexts;
+    vector<vector<int>> termPostings;
+    std::unordered_map<string, int> termIds;
+    vector<Node> tree;
+
+    int internTerm(const string& term);
+    static vector<string> termsOf(const Book& book);
+public:
+    static string foldVietnamese(const string& text);
+    static int editDistance(const string& a, const string& b);
+    static int maxDistanceFor(const string& word);
+
+    void add(const Book& book);
+    void remove(const Book& book);
+    void clear() { termTexts.clear(); termPostings.clear(); termIds.clear(); tree.clear(); }
+    ContainerMemory memoryUsage() const;
+
+    // Gọi fn(termPostings, distance) cho mọi từ trong từ điển cách word không quá maxDistance.
+    template <typename Fn>
+    void forEachNear(const string& word, int maxDistance, Fn fn) const {
+        if (tree.empty()) return;
+        vector<int> pending{ 0 };
+        while (!pending.empty()) {
+            const Node& node = tree[pending.back()];
+            pending.pop_back();
+            int d = editDistance(word, termTexts[node.termId]);
+            if (d <= maxDistance) fn(termPostings[node.termId], d);
+            for (const auto& child : node.children) {
+                if (child.first >= d - maxDistance && child.first <= d + maxDistance) {
+                    pending.push_back(child.second);
+                }
+            }
+        }
+    }
+};
+
+
+enum class DueEventKind {
+    Reminder,
+    Overdue
+};
+
+struct DueEvent {
+    int day{};
+    int loanId{};
+    int dueDate{};
+    DueEventKind kind{};
+
+    bool operator>(const DueEvent& other) const {
+        return day != other.day ? day > other.day : loanId > other.loanId;
+    }
+};
+
+// Min-heap các mốc nhắc hạn / quá hạn theo ngày. Gia hạn chỉ đẩy mốc mới, mốc cũ
+// bị bỏ qua khi lấy ra vì dueDate không còn khớp; phiếu đã trả cũng bị bỏ qua.
+class DueDateScheduler {
+private:
+    std::priority_queue<DueEvent, vector<DueEvent>, std::greater<DueEvent>> events;
+public:
+    static const int kReminderDays = 2;
+
+    void schedule(int loanId, int dueDate);
+    // Mốc quá hạn của ngày kế tiếp cho phiếu vẫn chưa trả.
+    void scheduleOverdue(int loanId, int dueDate, int day);
+    size_t pending() const { return events.size(); }
+
+    template <typename Fn>
+    void advanceTo(int today, Fn fn) {
+        while (!events.empty() && events.top().day <= today) {
+            DueEvent event = events.top();
+            events.pop();
+            fn(event);
+        }
+    }
+};
+
+struct Notification {
+    int memberId{};
+    int loanId{};
+    DueEventKind kind{};
+    NotificationPreference channel{};
+    string recipientName;
+    string recipientAddress;
+    string message;
+};
+
+class NotificationSink {
+public:
+    virtual ~NotificationSink() = default;
+    virtual void deliver(const vector<Notification>& batch) = 0;
+};
+
+// Giả lập hàng đợi SMTP: mỗi lô mở file spool một lần và ghi nối tiếp các thư.
+class MailSpoolSink : public NotificationSink {
+private:
+    string path;
+public:
+    explicit MailSpoolSink(const string& path) : path(path) {}
+    void deliver(const vector<Notification>& batch) override;
+};
+
+// Lô thư giấy để in: một dòng "ten|dia chi|noi dung" cho mỗi thông báo.
+class PostalBatchSink : public NotificationSink {
+private:
+    string path;
+public:
+    explicit PostalBatchSink(const string& path) : path(path) {}
+    void deliver(const vector<Notification>& batch) override;
+};
+
+// Hàng đợi có giới hạn + một luồng nền gom thông báo thành lô theo kênh rồi giao cho
+// sink tương ứng. Hàng đợi đầy thì người gửi chờ; luồng nền chỉ khởi động ở lần gửi đầu.
+class NotificationDispatcher {
+private:
+    std::mutex mutex;
+    std::condition_variable hasWork;
+    std::condition_variable hasRoom;
+    std::condition_variable drained;
+    std::deque<Notification> queue;
+    size_t capacity;
+    size_t batchSize;
+    size_t inFlight{ 0 };
+    bool stopping{ false };
+    std::unique_ptr<NotificationSink> emailSink;
+    std::unique_ptr<NotificationSink> postalSink;
+    std::thread worker;
+
+    void workerLoop();
+public:
+    explicit NotificationDispatcher(size_t capacity = 1024, size_t batchSize = 64);
+    ~NotificationDispatcher();
+    NotificationDispatcher(const NotificationDispatcher&) = delete;
+    NotificationDispatcher& operator=(const NotificationDispatcher&) = delete;
+
+    void setSink(NotificationPreference channel, std::unique_ptr<NotificationSink> sink);
+    void enqueue(Notification notification);
+    void flush();
+};
+
+// Kết quả/lỗi của các thao tác trong LibrarySystem. Thư viện không in ra màn hình mà
+// gửi sự kiện cho EventSink; UI tự quyết định hiển thị (describeEvent cho văn bản sẵn).
+enum class EventCode {
+    MemberRegistered,       // id: thành viên, text: số thẻ
+    EmailAlreadyExists,     // text: email
+    PasswordTooShort,       // value: độ dài tối thiểu
+    MemberHasOpenLoans,     // text: email
+    EmailNotRegistered,     // text: email
+    PasswordResetSent,      // text: email
+    PasswordChanged,        // id: thành viên
+    BookOnLoan,             // id: sách
+    MemberNotFound,         // id: thành viên
+    BorrowLimitExceeded,    // value: giới hạn
+    CopyUnavailable,        // id: bản sao
+    LoanCreated,            // id: phiếu mượn
+    LoanNotFound,           // id: phiếu mượn
+    LoanReturned,           // id: phiếu mượn, amount: tiền phạt
+    RenewalRefused,         // id: phiếu mượn
+    LoanRenewed,            // id: phiếu mượn, value: hạn trả mới
+    NotificationsQueued,    // value: số thông báo
+    JournalTailTruncated,   // text: đường dẫn
+    JournalOpenFailed,      // text: đường dẫn
+    JournalWriteFailed,     // text: đường dẫn
+    SnapshotReadFailed,     // text: đường dẫn
+    SnapshotWriteFailed,    // text: đường dẫn
+    SnapshotDamaged         // text: đường dẫn
+};
+
+struct LibraryEvent {
+    EventCode code{};
+    int id{};
+    int value{};
+    double amount{};
+    string text;
+
+    bool isError() const;
+};
+
+string describeEvent(const LibraryEvent& event);
+
+class EventSink {
+public:
+    virtual ~EventSink() = default;
+    // Có thể được gọi từ nhiều luồng (vd. luồng nạp catalog nền).
+    virtual void publish(const LibraryEvent& event) = 0;
+    virtual void flush() {}
+};
+
+// Bỏ qua mọi sự kiện; dùng cho nạp/nhập hàng loạt và khi chạy không có giao diện.
+class NullEventSink : public EventSink {
+public:
+    void publish(const LibraryEvent&) override {}
+};
+
+// Sự kiện được xếp hàng rồi một luồng nền định dạng và ghi ra cout theo lô, nên thao
+// tác của thư viện không phải chờ terminal. flush() chờ in xong, UI gọi trước khi in tiếp.
+class ConsoleEventSink : public EventSink {
+private:
+    std::mutex mutex;
+    std::condition_variable hasWork;
+    std::condition_variable drained;
+    std::deque<LibraryEvent> queue;
+    bool writing{ false };
+    bool stopping{ false };
+    std::thread worker;
+
+    void workerLoop();
+public:
+    ConsoleEventSink() = default;
+    ~ConsoleEventSink() override;
+    ConsoleEventSink(const ConsoleEventSink&) = delete;
+    ConsoleEventSink& operator=(const ConsoleEventSink&) = delete;
+
+    void publish(const LibraryEvent& event) override;
+    void flush() override;
+};
+
+// Bản ghi journal: chuỗi các số nguyên và chuỗi có độ dài đi trước. Đọc quá cuối
+// bản ghi không ném ngoại lệ mà bật cờ failed() để người đọc bỏ qua bản ghi đó.
+class JournalRecord {
+private:
+    string bytes;
+    size_t readPosition{ 0 };
+    bool readFailed{ false };
+public:
+    JournalRecord() = default;
+    explicit JournalRecord(string payload) : bytes(std::move(payload)) {}
+
+    JournalRecord& putInt(int64_t value);
+    JournalRecord& putDouble(double value);
+    JournalRecord& putString(const string& value);
+    int64_t readInt();
+    double readDouble();
+    string readString();
+    bool failed() const { return readFailed; }
+    const string& payload() const { return bytes; }
+};
+
+// Tệp journal chỉ ghi nối. Mỗi khung: độ dài, CRC-32, LSN, nội dung. Bản ghi được
+// write() ngay (không mất khi tiến trình chết); fsync gom theo nhóm số bản ghi/thời gian.
+class Journal {
+private:
+    int fd{ -1 };
+    string path;
+    uint64_t nextLsn{ 1 };
+    size_t unsynced{ 0 };
+    size_t sinceCheckpoint{ 0 };
+    bool tailTruncated{ false };
+    std::chrono::steady_clock::time_point lastSync;
+public:
+    static constexpr size_t kGroupCommitRecords = 32;
+    static constexpr int kGroupCommitMillis = 50;
+
+    Journal() = default;
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    static string frame(uint64_t lsn, const string& payload);
+    // Gọi fn cho từng khung hợp lệ; dừng ở khung hỏng/cụt đầu tiên.
+    // Trả về số byte hợp lệ tính từ đầu tệp (-1 nếu tệp không tồn tại).
+    static long long readAll(const string& path,
+                             const std::function<void(uint64_t, JournalRecord&)>& fn);
+    static bool writeFileDurably(const string& path, const string& content);
+
+    bool open(const string& path, uint64_t nextLsn, long long validBytes);
+    bool isOpen() const { return fd >= 0; }
+    // true nếu lần open() gần nhất phải cắt bỏ phần đuôi hỏng.
+    bool truncatedTail() const { return tailTruncated; }
+    uint64_t lastLsn() const { return nextLsn - 1; }
+    size_t recordsSinceCheckpoint() const { return sinceCheckpoint; }
+    bool append(const JournalRecord& record);
+    void sync();
+    bool truncate();
+    void close();
+};
+
+enum class MetricOp {
+    Login,
+    RegisterMember,
+    SearchBooks,
+    SearchBooksPage,
+    SearchFacets,
+    Autocomplete,
+    FuzzySearch,
+    BorrowBooks,
+    ReturnLoan,
+    RenewLoan,
+    ImportBooks,
+    ImportMembers,
+    LoadSnapshot,
+    OpenJournal,
+    Checkpoint
+};
+
+const size_t kMetricOpCount = static_cast<size_t>(MetricOp::Checkpoint) + 1;
+
+const char* metricOpName(MetricOp op);
+
+// Histogram kiểu HDR: mỗi khoảng [2^k, 2^(k+1)) chia đều 16 ô, sai số tương đối ~6%
+// trên toàn dải giá trị 64 bit (đơn vị nano giây).
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketLowerBound(size_t bucket);
+    static uint64_t bucketUpperBound(size_t bucket);
+};
+
+struct OperationStats {
+    MetricOp op{};
+    uint64_t count{};
+    uint64_t totalNanos{};
+    uint64_t maxNanos{};
+    vector<uint64_t> buckets;
+
+    // Giá trị lớn nhất của ô chứa phân vị q (0..1), không vượt quá maxNanos.
+    uint64_t percentile(double q) const;
+};
+
+// Bộ đếm + histogram theo thao tác. Mỗi luồng ghi vào shard riêng (chỉ atomic relaxed,
+// không tranh chấp), đọc thì cộng dồn mọi shard. Shard sống cùng đối tượng Metrics.
+class Metrics {
+private:
+    struct OpShard {
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> totalNanos{ 0 };
+        std::atomic<uint64_t> maxNanos{ 0 };
+        std::atomic<uint64_t> buckets[LatencyHistogram::kBucketCount]{};
+    };
+    struct Shard {
+        std::thread::id owner;
+        OpShard ops[kMetricOpCount];
+    };
+
+    uint64_t instanceId;
+    std::mutex shardsMutex;
+    vector<std::unique_ptr<Shard>> shards;
+
+    Shard& localShard();
+public:
+    Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void record(MetricOp op, uint64_t nanos);
+    vector<OperationStats> snapshot();
+};
+
+// Đo thời gian một phạm vi và ghi vào Metrics khi ra khỏi phạm vi.
+class ScopedTimer {
+private:
+    Metrics& metrics;
+    MetricOp op;
+    std::chrono::steady_clock::time_point start;
+public:
+    ScopedTimer(Metrics& metrics, MetricOp op)
+        : metrics(metrics), op(op), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        metrics.record(op, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Span được ghi vào vòng đệm riêng của từng luồng chỉ bằng atomic (không khoá); khi
+// cần thì xuất toàn bộ ra JSON trace_event của Chrome (chrome://tracing, Perfetto).
+// Mỗi luồng giữ kTraceRingCapacity span gần nhất. name/category phải là chuỗi hằng.
+class Tracer {
+public:
+    static constexpr size_t kTraceRingCapacity = 8192;
+
+    static void setEnabled(bool enabled);
+    static bool enabled();
+    // Nano giây kể từ lúc tracer khởi tạo, luôn >= 1.
+    static uint64_t now();
+    static void record(const char* name, const char* category, uint64_t startNanos, uint64_t endNanos);
+    static bool writeChromeTrace(const string& path);
+};
+
+class TraceSpan {
+private:
+    const char* name;
+    const char* category;
+    uint64_t start;
+public:
+    explicit TraceSpan(const char* name, const char* category = "library")
+        : name(name), category(category), start(Tracer::enabled() ? Tracer::now() : 0) {}
+    ~TraceSpan() {
+        if (start) Tracer::record(name, category, start, Tracer::now());
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+struct CatalogLoadStatus {
+    bool loading{ false };
+    size_t booksLoaded{};
+    size_t booksTotal{};
+};
+
+struct ImportError {
+    size_t line{};
+    string reason;
+};
+
+struct ImportReport {
+    bool opened{ false };
+    size_t imported{};
+    vector<ImportError> errors;
+};
 
 class LibrarySystem {
 private:
-    vector<MemberAccount> members;
+    // deque giữ nguyên địa chỉ phần tử khi thêm mới, nên con trỏ trả về từ
+    // login/registerMember và các khoá string_view trong emailIndex luôn hợp lệ.
+    // Thành viên bị xoá chỉ bị gỡ khỏi chỉ mục, đối tượng vẫn nằm lại trong deque.
+    std::deque<MemberAccount> members;
     vector<Book> books;
     vector<BookItem> copies;
     vector<Loan> loans;
     vector<Reservation> reservations;
+    // Số phần tử đã xoá (tombstone) còn nằm trong books / copies.
+    size_t removedBooks{ 0 };
+    size_t removedCopies{ 0 };
+
+    IdTable memberTable;
+    vector<MemberLoanState> memberLoans;
+    std::unordered_map<std::string_view, int> emailIndex;
+    IdTable bookTable;
+    IdTable copyTable;
+    IdTable copyActiveLoan;
+    vector<CopyGroup> copyGroups;
+    std::unordered_multimap<string, int> isbnIndex;
+    std::unordered_map<string, int> barcodeIndex;
+    // Các chỉ mục tìm kiếm có thể được dựng muộn trong hàm const (ensureSearchIndexes).
+    mutable TrigramIndex keywordIndex;
+    mutable FacetIndex facetIndex;
+    mutable PrefixIndex prefixIndex;
+    mutable FuzzyIndex fuzzyIndex;
+    mutable std::mutex searchIndexMutex;
+    mutable std::atomic<bool> searchIndexesStale{ false };
+    IdTable loanTable;
+    DueDateScheduler dueDates;
+    Journal journal;
+    string journalPath;
+    NotificationDispatcher notifier;
+    std::unique_ptr<EventSink> events{ std::make_unique<NullEventSink>() };
+    mutable Metrics metrics;
+
+    // Nạp catalog nền: luồng nạp giữ khoá ghi theo từng lô, các truy vấn trong lúc
+    // nạp giữ khoá đọc. catalogReady bật lên thì không còn ai ghi từ luồng khác.
+    mutable std::shared_mutex catalogMutex;
+    std::unique_lock<std::shared_mutex>* loaderLock{ nullptr };
+    std::atomic<bool> catalogReady{ true };
+    mutable std::mutex catalogReadyMutex;
+    mutable std::condition_variable catalogReadyCv;
+    std::atomic<size_t> catalogBooksLoaded{ 0 };
+    size_t catalogBooksTotal{ 0 };
+    std::thread catalogLoader;
 
     int nextMemberId{ 1 };
     int nextBookId{ 1 };
@@ -213,8 +1073,61 @@ private:
     int maxRenewals{ 2 };
     double finePerDay{ 1.0 };
 
+    uint64_t catalogGeneration{ 0 };
+    mutable QueryCache queryCache;
+
+    mutable std::once_flag workerPoolOnce;
+    mutable std::unique_ptr<ThreadPool> workerPool;
+    mutable std::once_flag loginPoolOnce;
+    mutable std::unique_ptr<ThreadPool> loginPool;
+
+    ThreadPool& sharedPool() const;
+
+    vector<int> searchBooksUncached(const string& lowerKey,
+                                    const string& author,
+                                    const string& subject,
+                                    int year,
+                                    SearchMode mode) const;
+    vector<int> parallelScan(const string& foldedKeyword,
+                             const string& author,
+                             const string& subject,
+                             int year) const;
+    void compactCatalog();
+    void insertCopies(int bookId, int numCopies, const string& rackPosition);
+    const CopyGroup* findCopyGroup(int bookId) const;
+    void setCopyAvailable(BookItem& copy, bool value);
+    MemberLoanState& loanStateOf(int memberId);
+    void closeLoan(const Loan& loan);
+    bool isLoanOpen(const Loan& loan) const;
+    void indexBook(const Book& book);
+    void logRegisterMember(const MemberAccount& m);
+    void addToSearchIndexes(const Book& book) const;
+    void removeFromSearchIndexes(const Book& book);
+    void ensureSearchIndexes() const;
+    MemberAccount& insertMember(MemberAccount account);
+    Loan& insertLoan(const Loan& loan, bool open);
+    void finishReturn(Loan& loan, int actualReturnDate);
+    void finishRenew(Loan& loan, int extraDays);
+    bool journaling() const;
+    void logMutation(const JournalRecord& record);
+    void applyJournalRecord(JournalRecord& record);
+    void report(EventCode code, int id = 0, int value = 0, double amount = 0, const string& text = string());
+    bool loadSnapshotMembers(const char* base);
+    bool loadSnapshotCatalog(const char* base);
+    bool loadSnapshotLoans(const char* base);
+    void yieldCatalogLock();
+    void finishCatalogLoad();
+    void waitForCatalog() const;
+    vector<int> scanLoadedBooks(const string& lowerKey,
+                                const string& author,
+                                const string& subject,
+                                int year) const;
+
 public:
     LibrarySystem();
+    ~LibrarySystem();
+    LibrarySystem(const LibrarySystem&) = delete;
+    LibrarySystem& operator=(const LibrarySystem&) = delete;
 
     MemberAccount* registerMember(
         const string& fullName,
@@ -224,10 +1137,17 @@ public:
         const string& phone,
         const string& email,
         const string& password,
-        NotificationPreference pref);
+        NotificationPreference pref,
+        AccountRole role = AccountRole::Member);
 
-    MemberAccount* findMemberByEmail(const string& email);
-    const MemberAccount* findMemberByEmail(const string& email) const;
+    bool removeMember(std::string_view email);
+
+    MemberAccount* findMemberByEmail(std::string_view email);
+    const MemberAccount* findMemberByEmail(std::string_view email) const;
+    MemberAccount* findMemberById(int memberId);
+    // Kiểm tra mật khẩu chạy trên nhóm luồng đăng nhập riêng, nên một lần băm tốn kém
+    // không giữ luồng gọi hay các phiên khác. login() chờ kết quả rồi nâng cấp hash cũ.
+    std::future<bool> verifyPasswordAsync(const MemberAccount& member, const string& password) const;
     MemberAccount* login(const string& email, const string& password);
     void forgotPassword(const string& email, const string& newPassword);
 
@@ -254,26 +1174,89 @@ public:
 
     bool removeBook(int bookId);
 
-    const vector<Book>& getBooks() const { return books; }
-    const vector<BookItem>& getCopies() const { return copies; }
-    const vector<Loan>& getLoans() const { return loans; }
+    // Có thể chứa sách / bản sao đã xoá (isRemoved()); bookCount() chỉ đếm sách còn lại.
+    const vector<Book>& getBooks() const { waitForCatalog(); return books; }
+    const vector<BookItem>& getCopies() const { waitForCatalog(); return copies; }
+    size_t bookCount() const { waitForCatalog(); return books.size() - removedBooks; }
+    const vector<Loan>& getLoans() const { waitForCatalog(); return loans; }
 
     vector<int> searchBooks(const string& keyword,
                             const string& author,
                             const string& subject,
-                            int year) const;
+                            int year,
+                            SearchMode mode = SearchMode::Auto) const;
+
+    SearchPage searchBooksPage(const string& keyword,
+                               const string& author,
+                               const string& subject,
+                               int year,
+                               size_t limit,
+                               int afterId = -1) const;
+
+    QueryCacheStats queryCacheStats() const { return queryCache.stats(); }
+
+    FacetResult searchFacets(const FacetQuery& query) const;
+    vector<Suggestion> autocomplete(const string& typed, size_t limit) const;
+    vector<FuzzyMatch> fuzzySearch(const string& text, size_t limit) const;
 
     int countAvailableCopies(int bookId) const;
+    int countTotalCopies(int bookId) const;
+    bool isBookOnLoan(int bookId) const;
+    int findActiveLoanOfCopy(int copyId) const;
+    const BookItem* findAvailableCopy(int bookId) const;
 
     Loan* borrowBooks(int memberId, const vector<int>& bookItemIds, int today);
     bool returnLoan(int loanId, int actualReturnDate);
     bool renewLoan(int loanId, int extraDays);
 
-    void updateOverdueAndSendReminders(int today) const;
+    const vector<int>& getOpenLoanIds(int memberId) const;
+    int countBorrowedItems(int memberId) const;
+
+    void updateOverdueAndSendReminders(int today);
+    // Snapshot nhị phân (bản ghi cố định + vùng chuỗi), đọc qua mmap. loadSnapshot chỉ
+    // dùng cho hệ thống còn rỗng; lsn nhận LSN journal cuối cùng mà snapshot đã bao gồm.
+    bool writeSnapshot(const string& path, uint64_t lsn = 0) const;
+    bool loadSnapshot(const string& path, uint64_t* lsn = nullptr);
+
+    // Nhập data.txt / users.txt: đọc cả tệp một lần, tách trường bằng string_view trên
+    // nhiều luồng rồi chèn hàng loạt. Dòng sai định dạng được báo kèm số dòng.
+    ImportReport importBooksFile(const string& path);
+    ImportReport importMembersFile(const string& path);
+
+    static bool journalExists(const string& path);
+    // Nạp snapshot + journal tại path rồi mở journal để ghi tiếp. Nếu chưa có tệp nào,
+    // trạng thái hiện tại (vd. vừa nhập từ data.txt/users.txt) được ghi thành snapshot đầu.
+    // backgroundCatalog: chỉ nạp thành viên trước rồi trả về ngay; sách, bản sao và phiếu
+    // mượn được nạp trên một luồng riêng. Trong lúc đó tìm kiếm trả kết quả từng phần,
+    // các thao tác khác trên catalog chờ nạp xong.
+    bool openJournal(const string& path, bool backgroundCatalog = false);
+    CatalogLoadStatus catalogLoadStatus() const;
+    bool isCatalogLoading() const { return !catalogReady.load(std::memory_order_acquire); }
+    bool checkpoint();
+    void syncJournal();
+
+    void setNotificationSink(NotificationPreference channel, std::unique_ptr<NotificationSink> sink);
+    void flushNotifications();
+    vector<OperationStats> operationStats() const { return metrics.snapshot(); }
+    // Ghi số liệu ra tệp JSON: mỗi thao tác gồm số lần gọi, tổng/max, các phân vị và
+    // các ô histogram khác 0 (cận trên, số lần) để có thể gộp nhiều bản dump.
+    bool writeMetrics(const string& path) const;
+    // Bộ nhớ theo từng container của catalog, thành viên, phiếu mượn và các chỉ mục.
+    vector<ContainerMemory> memoryUsage() const;
+    bool writeMemoryReport(const string& path) const;
+
+    // Mặc định là NullEventSink; nullptr cũng đặt lại về NullEventSink.
+    void setEventSink(std::unique_ptr<EventSink> sink);
+    void flushEvents();
 
 
     Book* findBookById(int bookId);
     const Book* findBookById(int bookId) const;
     BookItem* findCopyById(int copyId);
     const BookItem* findCopyById(int copyId) const;
+    const Book* findBookByIsbn(const string& isbn) const;
+    BookItem* findCopyByBarcode(const string& barcode);
+    const BookItem* findCopyByBarcode(const string& barcode) const;
+    Loan* findLoanById(int loanId);
+    const Loan* findLoanById(int loanId) const;
 };
@@ -1,168 +1,120 @@
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <string>
 #include <vector>
 #include <fstream>
-#include <sstream>
-#include <map> 
 
 #include "Library.h"
 
 using namespace std;
 
-const int ROLE_MEMBER = 0;
-const int ROLE_LIBRARIAN = 1;
-const int ROLE_ADMIN = 2;
-
-map<string, int> globalUserRoles;
+const string JOURNAL_FILE = "library.journal";
+const string METRICS_FILE = "metrics.json";
+const string TRACE_FILE = "trace.json";
+const string MEMORY_FILE = "memory.json";
 
 void clearInput() {
     cin.clear();
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
-vector<string> split(const string& s, char delimiter) {
-    vector<string> tokens;
-    string token;
-    stringstream tokenStream(s);
-    while (getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
-    }
-    return tokens;
-}
-
-void saveBookToFile(string isbn, string title, string author, string subject, int year, int pages, string rack, int copies) {
-    ofstream outFile("data.txt", ios::app);
-    if (outFile.is_open()) {
-        outFile << isbn << "|" << title << "|" << author << "|" << subject << "|" 
-                << year << "|" << pages << "|" << rack << "|" << copies << "\n";
-        outFile.close();
-    }
-}
-
-void updateBookFile(const vector<Book>& books, const LibrarySystem& lib) {
-    ofstream outFile("data.txt", ios::trunc);
+void exportBooksToFile(const LibrarySystem& lib, const string& fileName) {
+    TraceSpan span("exportBooksToFile", "ui");
+    ofstream outFile(fileName, ios::trunc);
     if (outFile.is_open()) {
-        for (const auto& b : books) {
-            
-            int totalCopies = 0;
-            for (const auto& copy : lib.getCopies()) {
-                if (copy.getBookId() == b.getId()) totalCopies++;
-            }
+        for (const auto& b : lib.getBooks()) {
+            if (b.isRemoved()) continue;
             outFile << b.getIsbn() << "|" << b.getTitle() << "|" << b.getAuthor() << "|" 
                     << b.getSubject() << "|" << b.getPublicationYear() << "|" 
-                    << b.getPages() << "|" << b.getRackPosition() << "|" << totalCopies << "\n";
-        }
-        outFile.close();
-    }
-}
-
-void saveUserToFile(string name, string dob, int gender, string address, string phone, string email, string password, int pref, int role) {
-    ofstream outFile("users.txt", ios::app);
-    if (outFile.is_open()) {
-        outFile << name << "|" << dob << "|" << gender << "|" << address << "|" 
-                << phone << "|" << email << "|" << password << "|" << pref << "|" << role << "\n";
-        outFile.close();
-        globalUserRoles[email] = role;
-    }
-}
-
-void deleteUserFromFile(string emailToDelete) {
-    ifstream inFile("users.txt");
-    vector<string> lines;
-    string line;
-
-    while (getline(inFile, line)) {
-        if (line.empty()) continue;
-        vector<string> data = split(line, '|');
-    
-        if (data.size() >= 6) {
-            if (data[5] != emailToDelete) {
-                lines.push_back(line);
-            }
-        }
-    }
-    inFile.close();
-
-    ofstream outFile("users.txt", ios::trunc);
-    if (outFile.is_open()) {
-        for (const auto& l : lines) {
-            outFile << l << "\n";
+                    << b.getPages() << "|" << b.getRackPosition() << "|" << lib.countTotalCopies(b.getId()) << "\n";
         }
         outFile.close();
     }
 }
 
-void loadBooksFromFile(LibrarySystem& lib) {
-    ifstream inFile("data.txt");
-    if (!inFile.is_open()) return;
-    string line;
-    while (getline(inFile, line)) {
-        if (line.empty()) continue;
-        vector<string> data = split(line, '|');
-        if (data.size() >= 8) {
-            try {
-                int year = stoi(data[4]);
-                int pages = stoi(data[5]);
-                int copies = stoi(data[7]);
-                lib.addBook(data[0], data[1], data[2], data[3], year, "Vietnamese", pages, data[6], "Imported", copies);
-            } catch (...) {}
-        }
+void printImportReport(const string& fileName, const ImportReport& report) {
+    if (!report.opened) return;
+    cout << "Nhap " << report.imported << " ban ghi tu " << fileName;
+    if (!report.errors.empty()) cout << ", bo qua " << report.errors.size() << " dong loi";
+    cout << ".\n";
+    for (const auto& error : report.errors) {
+        cout << "  " << fileName << ":" << error.line << ": " << error.reason << "\n";
     }
-    inFile.close();
 }
 
-void loadUsersFromFile(LibrarySystem& lib) {
-    ifstream inFile("users.txt");
-    if (!inFile.is_open()) return;
-    string line;
-    while (getline(inFile, line)) {
-        if (line.empty()) continue;
-        vector<string> data = split(line, '|');
-        if (data.size() >= 9) {
-            try {
-                int genderInt = stoi(data[2]);
-                int prefInt = stoi(data[7]);
-                int role = stoi(data[8]);
-                
-                Gender gender = (genderInt == 1) ? Gender::Male : (genderInt == 2 ? Gender::Female : Gender::Other);
-                NotificationPreference pref = (prefInt == 2) ? NotificationPreference::PostalMail : NotificationPreference::Email;
-                
-                lib.registerMember(data[0], data[1], gender, data[3], data[4], data[5], data[6], pref);
-                globalUserRoles[data[5]] = role; 
-            } catch (...) {}
-        }
-    }
-    inFile.close();
+void showBookRow(const Book& b, int available) {
+    cout << "[ID: " << b.getId() << "] [ISBN: " << b.getIsbn() << "] " 
+         << b.getTitle() << " - " << b.getAuthor() 
+         << " (Con lai: " << available << ")\n";
 }
 
 void showBookList(const LibrarySystem& lib, const vector<int>& bookIds) {
-    const auto& books = lib.getBooks();
     cout << "\n--- KET QUA TIM KIEM ---\n";
     for (int id : bookIds) {
-        for (const auto& b : books) {
-            if (b.getId() == id) {
-                int available = lib.countAvailableCopies(id);
-                cout << "[ID: " << b.getId() << "] [ISBN: " << b.getIsbn() << "] " 
-                     << b.getTitle() << " - " << b.getAuthor() 
-                     << " (Con lai: " << available << ")\n";
-            }
-        }
+        const Book* b = lib.findBookById(id);
+        if (b) showBookRow(*b, lib.countAvailableCopies(id));
     }
 }
 
+const size_t SEARCH_PAGE_SIZE = 20;
+
+void printCatalogLoading(const LibrarySystem& lib) {
+    CatalogLoadStatus status = lib.catalogLoadStatus();
+    if (!status.loading) return;
+    cout << ">> Danh muc sach dang duoc tai (" << status.booksLoaded << "/" << status.booksTotal
+         << " dau sach), ket qua co the chua day du.\n";
+}
+
 void searchBooksFlow(LibrarySystem& lib) {
     string keyword;
     cout << "Nhap tu khoa: ";
     getline(cin, keyword);
-    vector<int> ids = lib.searchBooks(keyword, "", "", 0);
-    if (ids.empty()) cout << "Khong tim thay sach.\n";
-    else showBookList(lib, ids);
+    SearchPage page = lib.searchBooksPage(keyword, "", "", 0, SEARCH_PAGE_SIZE);
+    if (!page.hits.empty()) {
+        cout << "\n--- KET QUA TIM KIEM ---\n";
+        while (true) {
+            {
+                TraceSpan span("showSearchPage", "ui");
+                for (const auto& hit : page.hits) showBookRow(*hit.book, hit.availableCopies);
+            }
+            if (page.nextCursor < 0) break;
+            cout << "-- Enter de xem tiep, 'q' de dung: ";
+            string answer;
+            getline(cin, answer);
+            if (answer == "q" || answer == "Q") break;
+            page = lib.searchBooksPage(keyword, "", "", 0, SEARCH_PAGE_SIZE, page.nextCursor);
+        }
+        if (page.partial) printCatalogLoading(lib);
+        return;
+    }
+    cout << "Khong tim thay sach.\n";
+    TraceSpan span("searchFallback", "ui");
+    // Tìm gần đúng/gợi ý cần catalog đầy đủ; không bắt người dùng chờ nạp xong.
+    if (page.partial) {
+        printCatalogLoading(lib);
+        return;
+    }
+    vector<FuzzyMatch> similar = lib.fuzzySearch(keyword, 10);
+    if (!similar.empty()) {
+        cout << "Ket qua gan dung:";
+        vector<int> similarIds;
+        for (const auto& match : similar) similarIds.push_back(match.bookId);
+        showBookList(lib, similarIds);
+        return;
+    }
+    vector<Suggestion> suggestions = lib.autocomplete(keyword, 5);
+    if (!suggestions.empty()) {
+        cout << "Co phai ban muon tim:\n";
+        for (const auto& sg : suggestions) {
+            cout << "  - " << sg.title << " - " << sg.author << " (Con lai: " << sg.availableCopies << ")\n";
+        }
+    }
 }
 
-void createUserFlow(LibrarySystem& lib, int roleToCreate) {
-    string roleName = (roleToCreate == ROLE_ADMIN) ? "ADMIN" : 
-                      (roleToCreate == ROLE_LIBRARIAN) ? "THU THU" : "THANH VIEN";
+void createUserFlow(LibrarySystem& lib, AccountRole roleToCreate) {
+    string roleName = (roleToCreate == AccountRole::Admin) ? "ADMIN" : 
+                      (roleToCreate == AccountRole::Librarian) ? "THU THU" : "THANH VIEN";
                       
     cout << "\n--- TAO TAI KHOAN MOI (" << roleName << ") ---\n";
     string name, dob, email, pass, addr, phone;
@@ -180,10 +132,11 @@ void createUserFlow(LibrarySystem& lib, int roleToCreate) {
     if (genderChoice == 1) g = Gender::Male;
     else if (genderChoice == 2) g = Gender::Female;
 
-    MemberAccount* newMem = lib.registerMember(name, dob, g, addr, phone, email, pass, NotificationPreference::Email);
+    TraceSpan span("createUserFlow", "ui");
+    MemberAccount* newMem = lib.registerMember(name, dob, g, addr, phone, email, pass, NotificationPreference::Email, roleToCreate);
+    lib.flushEvents();
     
     if (newMem != nullptr) {
-        saveUserToFile(name, dob, genderChoice, addr, phone, email, pass, 1, roleToCreate);
         cout << ">> Tao tai khoan " << roleName << " thanh cong!\n";
     } else {
         cout << ">> Tao that bai (Email da ton tai).\n";
@@ -194,9 +147,9 @@ void displayCurrentUserInfo(MemberAccount* member) {
     cout << "\n----------------------------------------\n";
     cout << "          THONG TIN TAI KHOAN           \n";
     cout << "----------------------------------------\n";
-    int role = globalUserRoles[member->getEmail()];
-    string roleStr = (role == ROLE_ADMIN) ? "Quan Tri Vien (Admin)" : 
-                     (role == ROLE_LIBRARIAN ? "Thu Thu (Librarian)" : "Thanh Vien (Member)");
+    AccountRole role = member->getRole();
+    string roleStr = (role == AccountRole::Admin) ? "Quan Tri Vien (Admin)" : 
+                     (role == AccountRole::Librarian ? "Thu Thu (Librarian)" : "Thanh Vien (Member)");
 
     cout << "Ho va ten:    " << member->getName() << "\n";
     cout << "Email:        " << member->getEmail() << "\n";
@@ -209,6 +162,61 @@ void displayCurrentUserInfo(MemberAccount* member) {
     cout << "----------------------------------------\n";
 }
 
+void showMemberLoans(const LibrarySystem& lib, MemberAccount* member) {
+    TraceSpan span("showMemberLoans", "ui");
+    const auto& loanIds = lib.getOpenLoanIds(member->getId());
+    cout << "\n--- PHIEU MUON CUA TOI (" << lib.countBorrowedItems(member->getId()) << " cuon) ---\n";
+    if (loanIds.empty()) {
+        cout << "Ban khong co phieu muon nao chua tra.\n";
+        return;
+    }
+    for (int loanId : loanIds) {
+        const Loan* loan = lib.findLoanById(loanId);
+        if (!loan) continue;
+        cout << "Loan #" << loan->getId() << " | Han tra: " << loan->getDueDate() << " | Sach: ";
+        for (int copyId : loan->getBookItemIds()) {
+            const BookItem* copy = lib.findCopyById(copyId);
+            const Book* book = copy ? lib.findBookById(copy->getBookId()) : nullptr;
+            cout << (book ? book->getTitle() : "?") << " [" << (copy ? copy->getBarcode() : "?") << "] ";
+        }
+        cout << "\n";
+    }
+}
+
+// Thời gian hiển thị theo micro giây; bản đầy đủ (nano giây + histogram) ở metrics.json.
+void showOperationStats(const LibrarySystem& lib) {
+    cout << "\n--- THONG KE HIEU NANG (micro giay) ---\n";
+    cout << left << setw(20) << "Thao tac" << right << setw(10) << "So lan" << setw(12) << "TB"
+         << setw(12) << "p50" << setw(12) << "p99" << setw(12) << "Max" << "\n";
+    for (const auto& stats : lib.operationStats()) {
+        if (stats.count == 0) continue;
+        cout << left << setw(20) << metricOpName(stats.op) << right << setw(10) << stats.count
+             << setw(12) << stats.totalNanos / stats.count / 1000
+             << setw(12) << stats.percentile(0.50) / 1000 << setw(12) << stats.percentile(0.99) / 1000
+             << setw(12) << stats.maxNanos / 1000 << "\n";
+    }
+    if (lib.writeMetrics(METRICS_FILE)) {
+        cout << ">> Da ghi chi tiet ra " << METRICS_FILE << ".\n";
+    }
+}
+
+void showMemoryReport(const LibrarySystem& lib) {
+    cout << "\n--- BAO CAO BO NHO (KB) ---\n";
+    cout << left << setw(16) << "Container" << right << setw(10) << "So phan tu" << setw(10) << "Suc chua"
+         << setw(10) << "Phan tu" << setw(10) << "Chuoi" << setw(10) << "Heap khac" << setw(10) << "Tong" << "\n";
+    size_t total = 0;
+    for (const auto& usage : lib.memoryUsage()) {
+        cout << left << setw(16) << usage.name << right << setw(10) << usage.count << setw(10) << usage.capacity
+             << setw(10) << usage.inlineBytes / 1024 << setw(10) << usage.stringBytes / 1024
+             << setw(10) << usage.otherHeapBytes / 1024 << setw(10) << usage.totalBytes() / 1024 << "\n";
+        total += usage.totalBytes();
+    }
+    cout << "Tong cong: " << total / 1024 << " KB\n";
+    if (lib.writeMemoryReport(MEMORY_FILE)) {
+        cout << ">> Da ghi chi tiet ra " << MEMORY_FILE << ".\n";
+    }
+}
+
 void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
     bool running = true;
     while (running) {
@@ -219,6 +227,10 @@ void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
         cout << "2. Quan ly tai khoan (Them Thu thu/Admin)\n";
         cout << "3. Xoa tai khoan\n";
         cout << "4. Thong tin tai khoan\n";
+        cout << "5. Xuat danh muc sach ra data.txt\n";
+        cout << "6. Thong ke hieu nang\n";
+        cout << "7. Xuat trace (" << TRACE_FILE << ")\n";
+        cout << "8. Bao cao bo nho\n";
         cout << "0. DANG XUAT\n";
         cout << "Chon: ";
         
@@ -238,7 +250,6 @@ void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
             cout << "Ke sach: "; getline(cin, rack);
             
             lib.addBook(isbn, title, author, subject, year, "Vietnamese", pages, rack, "Added by Admin", copies);
-            saveBookToFile(isbn, title, author, subject, year, pages, rack, copies);
             cout << ">> Da them sach!\n";
         }
         else if (choice == 2) {
@@ -250,9 +261,9 @@ void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
             cout << "Chon loai tai khoan: ";
             int roleC; cin >> roleC; clearInput();
             
-            if (roleC == 1) createUserFlow(lib, ROLE_LIBRARIAN);
-            else if (roleC == 2) createUserFlow(lib, ROLE_ADMIN);
-            else if (roleC == 3) createUserFlow(lib, ROLE_MEMBER);
+            if (roleC == 1) createUserFlow(lib, AccountRole::Librarian);
+            else if (roleC == 2) createUserFlow(lib, AccountRole::Admin);
+            else if (roleC == 3) createUserFlow(lib, AccountRole::Member);
         }
 
         else if (choice == 3) {
@@ -262,15 +273,19 @@ void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
 
             if (emailDel == admin->getEmail()) {
                 cout << ">> LOI: Khong the tu xoa tai khoan dang su dung!\n";
-            } else if (globalUserRoles.find(emailDel) == globalUserRoles.end()) {
+            } else if (lib.findMemberByEmail(emailDel) == nullptr) {
                 cout << ">> LOI: Email khong ton tai trong he thong.\n";
             } else {
                 cout << "Xac nhan xoa user '" << emailDel << "'? (y/n): ";
                 char confirm; cin >> confirm; clearInput();
                 if (confirm == 'y' || confirm == 'Y') {
-                    deleteUserFromFile(emailDel);
-                    globalUserRoles.erase(emailDel);
-                    cout << ">> Da xoa tai khoan thanh cong! (Khoi dong lai de cap nhat bo nho).\n";
+                    bool removed = lib.removeMember(emailDel);
+                    lib.flushEvents();
+                    if (!removed) {
+                        cout << ">> Khong the xoa tai khoan.\n";
+                    } else {
+                        cout << ">> Da xoa tai khoan thanh cong!\n";
+                    }
                 } else {
                     cout << ">> Da huy thao tac.\n";
                 }
@@ -279,6 +294,21 @@ void runAdminMode(LibrarySystem& lib, MemberAccount* admin) {
         else if (choice == 4) {
             displayCurrentUserInfo(admin);
         }
+        else if (choice == 5) {
+            exportBooksToFile(lib, "data.txt");
+            cout << ">> Da xuat " << lib.bookCount() << " dau sach ra data.txt.\n";
+        }
+        else if (choice == 6) {
+            showOperationStats(lib);
+        }
+        else if (choice == 7) {
+            // Mở tệp bằng chrome://tracing hoặc ui.perfetto.dev.
+            if (Tracer::writeChromeTrace(TRACE_FILE)) cout << ">> Da ghi trace ra " << TRACE_FILE << ".\n";
+            else cout << ">> Khong the ghi " << TRACE_FILE << ".\n";
+        }
+        else if (choice == 8) {
+            showMemoryReport(lib);
+        }
     }
 }
 
@@ -307,13 +337,14 @@ void runLibrarianMode(LibrarySystem& lib, MemberAccount* librarian) {
                 int bChoice; cin >> bChoice; clearInput();
                 if(bChoice == 0) bookRunning = false;
                 else if(bChoice == 1) {
+                    TraceSpan span("listBooks", "ui");
                     const auto& allBooks = lib.getBooks();
-                    if(allBooks.empty()) cout << "Thu vien chua co sach.\n";
+                    if(lib.bookCount() == 0) cout << "Thu vien chua co sach.\n";
                     else {
                         cout << "\nDANH SACH TOAN BO SACH:\n";
                         for(const auto& b : allBooks) {
-                            int total = 0;
-                            for(const auto& c : lib.getCopies()) if(c.getBookId() == b.getId()) total++;
+                            if(b.isRemoved()) continue;
+                            int total = lib.countTotalCopies(b.getId());
                             cout << "ID: " << b.getId() << " | ISBN: " << b.getIsbn() << " | " << b.getTitle() 
                                  << " | Tac gia: " << b.getAuthor() << " | Tong so ban: " << total << "\n";
                         }
@@ -333,25 +364,27 @@ void runLibrarianMode(LibrarySystem& lib, MemberAccount* librarian) {
                     cout << "Ke sach: "; getline(cin, rack);
                     
                     lib.addBook(isbn, title, author, subject, year, "Vietnamese", pages, rack, "Added by Librarian", copies);
-                    saveBookToFile(isbn, title, author, subject, year, pages, rack, copies);
                     cout << ">> Da them sach thanh cong!\n";
                 }
                 else if(bChoice == 3) {
                     int bookId;
                     cout << "Nhap ID sach can xoa: "; cin >> bookId; clearInput();
-                    if(lib.removeBook(bookId)) {
-                        updateBookFile(lib.getBooks(), lib);
-                        cout << ">> Xoa sach thanh cong va da cap nhat file du lieu.\n";
+                    bool removed = lib.removeBook(bookId);
+                    lib.flushEvents();
+                    if(removed) {
+                        cout << ">> Xoa sach thanh cong.\n";
                     } else {
                         cout << ">> Khong the xoa (Sach khong ton tai hoac dang duoc muon).\n";
                     }
                 }
             }
         } else if (choice == 2) {
+            TraceSpan span("listLoans", "ui");
             cout << "\n--- DANH SACH PHIEU MUON ---\n";
             for (const auto& loan : lib.getLoans()) {
                  cout << "Loan #" << loan.getId() << " | MemberID: " << loan.getMemberId() 
-                      << " | Status: " << (loan.getStatus() == LoanStatus::Active ? "Active" : "Returned") << "\n";
+                      << " | Status: " << (loan.getStatus() == LoanStatus::Active ? "Active" :
+                                          loan.getStatus() == LoanStatus::Overdue ? "Overdue" : "Returned") << "\n";
             }
         } else if (choice == 3) {
             displayCurrentUserInfo(librarian);
@@ -369,6 +402,7 @@ void runMemberMode(LibrarySystem& lib, MemberAccount* member) {
         cout << "2. Muon sach (Nhap ISBN)\n";
         cout << "3. Tra sach\n";
         cout << "4. Thong tin tai khoan\n";
+        cout << "5. Phieu muon cua toi\n";
         cout << "0. DANG XUAT\n";
         cout << "Chon: ";
 
@@ -380,30 +414,27 @@ void runMemberMode(LibrarySystem& lib, MemberAccount* member) {
             cout << "Nhap ISBN sach muon muon: ";
             string isbn;
             getline(cin, isbn);
+            TraceSpan span("checkout", "ui");
 
             int targetBookId = -1;
             string bookTitle = "";
-            for (const auto& b : lib.getBooks()) {
-                if (b.getIsbn() == isbn) {
-                    targetBookId = b.getId();
-                    bookTitle = b.getTitle();
-                    break;
-                }
+            if (const Book* b = lib.findBookByIsbn(isbn)) {
+                targetBookId = b->getId();
+                bookTitle = b->getTitle();
             }
 
             if (targetBookId == -1) {
                 cout << ">> Khong tim thay sach voi ISBN: " << isbn << "\n";
             } else {
                 int availableCopyId = -1;
-                for (const auto& copy : lib.getCopies()) {
-                    if (copy.getBookId() == targetBookId && copy.isAvailable()) {
-                        availableCopyId = copy.getId();
-                        break;
-                    }
+                if (const BookItem* copy = lib.findAvailableCopy(targetBookId)) {
+                    availableCopyId = copy->getId();
                 }
 
                 if (availableCopyId != -1) {
-                    if(lib.borrowBooks(member->getId(), {availableCopyId}, 1)) {
+                    Loan* loan = lib.borrowBooks(member->getId(), {availableCopyId}, 1);
+                    lib.flushEvents();
+                    if(loan) {
                         cout << ">> Muon thanh cong cuon: " << bookTitle << "\n";
                     } else {
                         cout << ">> Loi he thong khi muon.\n";
@@ -415,23 +446,43 @@ void runMemberMode(LibrarySystem& lib, MemberAccount* member) {
             
         } else if (choice == 3) {
             cout << "Nhap LoanID de tra: "; int lid; cin >> lid; clearInput();
-            lib.returnLoan(lid, 1);
+            TraceSpan span("returnFlow", "ui");
+            const Loan* loan = lib.findLoanById(lid);
+            if (loan && loan->getMemberId() != member->getId()) {
+                cout << ">> Phieu muon #" << lid << " khong thuoc ve ban.\n";
+            } else {
+                lib.returnLoan(lid, 1);
+                lib.flushEvents();
+            }
         } else if (choice == 4) {
             displayCurrentUserInfo(member);
+        } else if (choice == 5) {
+            showMemberLoans(lib, member);
         }
     }
 }
 
 int main() {
     LibrarySystem lib;
+    lib.setEventSink(std::make_unique<ConsoleEventSink>());
     
-    loadBooksFromFile(lib);
-    loadUsersFromFile(lib);
+    // data.txt / users.txt chỉ dùng để nhập dữ liệu ở lần chạy đầu; sau đó snapshot + journal
+    // là nguồn chính.
+    // Từ lần chạy thứ hai, danh mục sách được nạp nền: thành viên có ngay nên có thể
+    // đăng nhập trong khi catalog còn đang tải.
+    {
+        TraceSpan span("startup", "ui");
+        if (!LibrarySystem::journalExists(JOURNAL_FILE)) {
+            printImportReport("users.txt", lib.importMembersFile("users.txt"));
+            printImportReport("data.txt", lib.importBooksFile("data.txt"));
+        }
+        lib.openJournal(JOURNAL_FILE, true);
 
-    if (lib.findMemberByEmail("admin") == nullptr) {
-        lib.registerMember("System Administrator", "01/01/1990", Gender::Other, "Server", "0000", "admin", "123456", NotificationPreference::Email);
-        saveUserToFile("System Administrator", "01/01/1990", 3, "Server", "0000", "admin", "123456", 1, ROLE_ADMIN);
+        if (lib.findMemberByEmail("admin") == nullptr) {
+            lib.registerMember("System Administrator", "01/01/1990", Gender::Other, "Server", "0000", "admin", "123456", NotificationPreference::Email, AccountRole::Admin);
+        }
     }
+    lib.flushEvents();
 
     while (true) {
         cout << "\n=======================================\n";
@@ -445,10 +496,15 @@ int main() {
 
         int choice; cin >> choice; clearInput();
 
-        if (choice == 0) break;
+        if (choice == 0) {
+            // Ghi snapshot khi thoát để lần khởi động sau không phải đọc lại journal.
+            lib.checkpoint();
+            lib.flushEvents();
+            break;
+        }
         else if (choice == 1) searchBooksFlow(lib);
         else if (choice == 2) {
-            createUserFlow(lib, ROLE_MEMBER);
+            createUserFlow(lib, AccountRole::Member);
         }
         else if (choice == 3) {
             cout << "\n--- DANG NHAP ---\n";
@@ -456,16 +512,20 @@ int main() {
             cout << "Email: "; getline(cin, email);
             cout << "Mat khau: "; getline(cin, pass);
 
-            MemberAccount* user = lib.login(email, pass);
+            MemberAccount* user = nullptr;
+            {
+                TraceSpan span("login", "ui");
+                user = lib.login(email, pass);
+            }
 
             if (user == nullptr) {
                 cout << ">> Dang nhap that bai!\n";
             } else {
-                int role = globalUserRoles[email];
+                AccountRole role = user->getRole();
                 
-                if (role == ROLE_ADMIN) {
+                if (role == AccountRole::Admin) {
                     runAdminMode(lib, user);
-                } else if (role == ROLE_LIBRARIAN) {
+                } else if (role == AccountRole::Librarian) {
                     runLibrarianMode(lib, user);
                 } else {
                     runMemberMode(lib, user);